@@ -0,0 +1,45 @@
+# ASIO_IO_URING additionally builds <target>_uring for every target passed
+# to add_io_uring_variant (), from the same sources but with Asio's
+# io_uring backend in place of epoll. liburing must be installed; without
+# it the option only warns, so the default programs still build.
+
+option(ASIO_IO_URING "Also build io_uring variants of the programs" OFF)
+
+set(ASIO_HAVE_IO_URING OFF)
+if(ASIO_IO_URING)
+  find_path(URING_INCLUDE_DIR liburing.h)
+  find_library(URING_LIBRARY uring)
+
+  if(URING_INCLUDE_DIR AND URING_LIBRARY)
+    set(ASIO_HAVE_IO_URING ON)
+  else()
+    message(WARNING "liburing not found, io_uring variants are skipped")
+  endif()
+endif()
+
+function(add_io_uring_variant target)
+  if(NOT ASIO_HAVE_IO_URING)
+    return()
+  endif()
+
+  set(variant ${target}_uring)
+  get_target_property(sources ${target} SOURCES)
+  get_target_property(includes ${target} INCLUDE_DIRECTORIES)
+  get_target_property(libraries ${target} LINK_LIBRARIES)
+
+  add_executable(${variant} ${sources})
+  if(includes)
+    target_include_directories(${variant} PRIVATE ${includes})
+  endif()
+  if(libraries)
+    target_link_libraries(${variant} PRIVATE ${libraries})
+  endif()
+
+  target_compile_definitions(${variant}
+    PRIVATE
+      BOOST_ASIO_HAS_IO_URING=1
+      BOOST_ASIO_DISABLE_EPOLL=1
+  )
+  target_include_directories(${variant} PRIVATE ${URING_INCLUDE_DIR})
+  target_link_libraries(${variant} PRIVATE ${URING_LIBRARY})
+endfunction()
@@ -0,0 +1,132 @@
+#ifndef HANDLER_MEMORY_H
+#define HANDLER_MEMORY_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio/bind_allocator.hpp>
+
+// One recycled block for the handlers of a single chain of asynchronous
+// operations, such as a session's receive, write, receive, ... Asio frees
+// an operation's memory before it invokes the handler, so while a chain
+// has at most one operation outstanding, every operation after the first
+// reuses the block and nothing reaches malloc. Requests that do not fit,
+// or that arrive while the block is taken, fall back to operator new.
+//
+// Not synchronized: the chain itself must be serialized, by a strand or
+// by a single-threaded io_context. The memory must outlive every operation
+// allocated from it, even one still queued when its io_context is torn
+// down; keep it in an object the handler itself holds a reference to.
+template <std::size_t Size = 1024>
+class handler_memory
+{
+public:
+  handler_memory () : in_use_ (false) {}
+
+  handler_memory (const handler_memory &) = delete;
+  handler_memory &operator= (const handler_memory &) = delete;
+
+  void *
+  allocate (std::size_t size)
+  {
+    if (!in_use_ && size <= Size)
+      {
+	in_use_ = true;
+	return &storage_;
+      }
+    return ::operator new (size);
+  }
+
+  void
+  deallocate (void *p) noexcept
+  {
+    if (p == &storage_)
+      in_use_ = false;
+    else
+      ::operator delete (p);
+  }
+
+private:
+  typename std::aligned_storage<Size>::type storage_;
+  bool in_use_;
+};
+
+template <typename T, std::size_t Size = 1024>
+class handler_allocator
+{
+  template <typename, std::size_t>
+  friend class handler_allocator;
+
+public:
+  using value_type = T;
+
+  template <typename U>
+  struct rebind
+  {
+    using other = handler_allocator<U, Size>;
+  };
+
+  explicit handler_allocator (handler_memory<Size> &memory) noexcept
+      : memory_ (&memory)
+  {
+  }
+
+  template <typename U>
+  handler_allocator (const handler_allocator<U, Size> &other) noexcept
+      : memory_ (other.memory_)
+  {
+  }
+
+  T *
+  allocate (std::size_t n)
+  {
+    return static_cast<T *> (memory_->allocate (sizeof (T) * n));
+  }
+
+  void
+  deallocate (T *p, std::size_t /*n*/) noexcept
+  {
+    memory_->deallocate (p);
+  }
+
+  handler_memory<Size> *
+  memory () const noexcept
+  {
+    return memory_;
+  }
+
+  template <typename U>
+  friend bool
+  operator== (const handler_allocator &a,
+	      const handler_allocator<U, Size> &b) noexcept
+  {
+    return a.memory () == b.memory ();
+  }
+
+  template <typename U>
+  friend bool
+  operator!= (const handler_allocator &a,
+	      const handler_allocator<U, Size> &b) noexcept
+  {
+    return a.memory () != b.memory ();
+  }
+
+private:
+  handler_memory<Size> *memory_;
+};
+
+// Makes handler allocate its operations from memory.
+template <std::size_t Size, typename Handler>
+auto
+bind_handler_memory (handler_memory<Size> &memory, Handler &&handler)
+    -> decltype (boost::asio::bind_allocator (
+	handler_allocator<char, Size> (memory),
+	std::forward<Handler> (handler)))
+{
+  return boost::asio::bind_allocator (handler_allocator<char, Size> (memory),
+				      std::forward<Handler> (handler));
+}
+
+#endif // HANDLER_MEMORY_H
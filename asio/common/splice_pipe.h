@@ -0,0 +1,133 @@
+#ifndef SPLICE_PIPE_H
+#define SPLICE_PIPE_H
+
+#include <cerrno>
+#include <cstddef>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/asio/error.hpp>
+#include <boost/system/error_code.hpp>
+
+// A non-blocking pipe for moving data between sockets with splice (2):
+// fill () moves bytes from a socket into the pipe and drain () moves them
+// on to a socket, so they never pass through user space. Both sockets
+// must be in non-blocking mode.
+//
+// A pipe costs two descriptors, so it is meant to be borrowed from an
+// object_pool only while data is in flight and handed back empty. One
+// left holding data, after a failed drain, is reset () first.
+class splice_pipe
+{
+public:
+  splice_pipe () { open (); }
+
+  ~splice_pipe () { close (); }
+
+  splice_pipe (const splice_pipe &) = delete;
+  splice_pipe &operator= (const splice_pipe &) = delete;
+
+  // Reopens the pipe if it could not be created before, for instance for
+  // lack of descriptors; false if it still cannot be.
+  bool
+  ensure_open () noexcept
+  {
+    if (fds_[0] < 0)
+      open ();
+    return fds_[0] >= 0;
+  }
+
+  // Bytes moved in by fill () and not yet out by drain ().
+  size_t
+  size () const noexcept
+  {
+    return size_;
+  }
+
+  bool
+  full () const noexcept
+  {
+    return size_ == capacity_;
+  }
+
+  // Moves what the socket fd has, up to the pipe's free space, into the
+  // pipe. Sets error to eof at the end of the stream, to would_block when
+  // nothing is available, and to invalid_argument when fd does not
+  // support splicing, in which case nothing was moved.
+  size_t
+  fill (int fd, boost::system::error_code &error) noexcept
+  {
+    return move (fd, fds_[1], capacity_ - size_, +1, error);
+  }
+
+  // Moves as much of the pipe's contents as the socket fd takes. Sets
+  // error to would_block when the socket's send buffer is full.
+  size_t
+  drain (int fd, boost::system::error_code &error) noexcept
+  {
+    return move (fds_[0], fd, size_, -1, error);
+  }
+
+  // Discards the contents.
+  void
+  reset () noexcept
+  {
+    close ();
+    open ();
+  }
+
+private:
+  void
+  open () noexcept
+  {
+    size_ = 0;
+    capacity_ = 0;
+    if (::pipe2 (fds_, O_NONBLOCK | O_CLOEXEC) != 0)
+      {
+	fds_[0] = fds_[1] = -1;
+	return;
+      }
+
+    int capacity = ::fcntl (fds_[0], F_GETPIPE_SZ);
+    capacity_ = capacity > 0 ? capacity : 4096;
+  }
+
+  void
+  close () noexcept
+  {
+    if (fds_[0] < 0)
+      return;
+    ::close (fds_[0]);
+    ::close (fds_[1]);
+    fds_[0] = fds_[1] = -1;
+  }
+
+  size_t
+  move (int in, int out, size_t max, int sign,
+	boost::system::error_code &error) noexcept
+  {
+    error.clear ();
+    ssize_t n = ::splice (in, nullptr, out, nullptr, max,
+			  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0)
+      {
+	size_ += sign * n;
+	return n;
+      }
+
+    if (n == 0)
+      error = boost::asio::error::eof;
+    else if (errno == EAGAIN)
+      error = boost::asio::error::would_block;
+    else
+      error.assign (errno, boost::system::system_category ());
+    return 0;
+  }
+
+  int fds_[2];
+  size_t size_;
+  size_t capacity_;
+};
+
+#endif // SPLICE_PIPE_H
@@ -0,0 +1,155 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+// Idle timeouts for any number of sessions with a single timer. Time is
+// counted in coarse ticks; on the hot path a session only stores the
+// current tick as its last activity, which is one relaxed load and one
+// relaxed store and never touches the wheel's buckets.
+//
+// Each session sits in the bucket of the tick at which it would expire if
+// it stayed idle. Every tick the wheel takes that bucket and looks at each
+// of its sessions once: those idle for longer than the timeout get
+// expire () called, the others move to the bucket of their new deadline.
+// A session is thus visited about once per timeout period however often
+// it is active, and expires between timeout and timeout + resolution after
+// its last activity.
+//
+// Session must provide last_activity (), returning the tick it last
+// stored, and expire (), which may be called from the wheel's executor
+// and must hand the work to the session's own. Sessions are held weakly;
+// one that has gone away is dropped when its bucket comes round.
+template <typename Session>
+class timing_wheel
+{
+public:
+  using tick_type = std::uint32_t;
+  using clock = std::chrono::steady_clock;
+
+  timing_wheel (boost::asio::any_io_executor ex, clock::duration timeout,
+		clock::duration resolution = std::chrono::milliseconds (250))
+      : timer_ (ex), resolution_ (resolution),
+	timeout_ticks_ ((timeout + resolution - clock::duration (1))
+			/ resolution),
+	now_ (0)
+  {
+    size_t slots = 2;
+    while (slots <= timeout_ticks_ + 1)
+      slots *= 2;
+    buckets_.resize (slots);
+  }
+
+  timing_wheel (const timing_wheel &) = delete;
+  timing_wheel &operator= (const timing_wheel &) = delete;
+
+  // The current tick, for sessions to record as their last activity.
+  tick_type
+  now () const noexcept
+  {
+    return now_.load (std::memory_order_relaxed);
+  }
+
+  // Starts watching s, whose last activity must already be set. Safe to
+  // call from any thread.
+  void
+  add (const std::shared_ptr<Session> &s)
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    bucket (s->last_activity ()).push_back (s);
+  }
+
+  void
+  start ()
+  {
+    next_tick_ = clock::now ();
+    schedule ();
+  }
+
+  void
+  stop ()
+  {
+    timer_.cancel ();
+  }
+
+private:
+  using bucket_type = std::vector<std::weak_ptr<Session>>;
+
+  bucket_type &
+  bucket (tick_type last_activity)
+  {
+    tick_type deadline = last_activity + timeout_ticks_ + 1;
+    return buckets_[deadline & (buckets_.size () - 1)];
+  }
+
+  void
+  schedule ()
+  {
+    // Ticks follow the clock rather than the previous wait, so a late
+    // handler does not make every later deadline late too.
+    next_tick_ += resolution_;
+    timer_.expires_at (next_tick_);
+    timer_.async_wait ([this] (const boost::system::error_code &error)
+      {
+	if (error)
+	  return;
+	advance ();
+	schedule ();
+      });
+  }
+
+  void
+  advance ()
+  {
+    tick_type now = now_.load (std::memory_order_relaxed) + 1;
+    now_.store (now, std::memory_order_relaxed);
+
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      due_.swap (buckets_[now & (buckets_.size () - 1)]);
+    }
+
+    // Sessions are expired or moved outside the lock, so that add () from
+    // other threads does not wait for a whole bucket.
+    moved_.clear ();
+    for (auto &weak : due_)
+      {
+	std::shared_ptr<Session> s = weak.lock ();
+	if (!s)
+	  continue;
+	if (tick_type (now - s->last_activity ()) > timeout_ticks_)
+	  s->expire ();
+	else
+	  moved_.push_back (std::move (s));
+      }
+    due_.clear ();
+
+    std::lock_guard<std::mutex> lock (mutex_);
+    for (auto &s : moved_)
+      bucket (s->last_activity ()).push_back (s);
+    moved_.clear ();
+  }
+
+  boost::asio::steady_timer timer_;
+  clock::duration resolution_;
+  tick_type timeout_ticks_;
+  std::atomic<tick_type> now_;
+  clock::time_point next_tick_;
+
+  std::mutex mutex_;
+  std::vector<bucket_type> buckets_;
+
+  // Only touched by advance (); kept to reuse their capacity.
+  bucket_type due_;
+  std::vector<std::shared_ptr<Session>> moved_;
+};
+
+#endif // TIMING_WHEEL_H
@@ -0,0 +1,194 @@
+// Heap allocations per echo round trip, with and without recycled handler
+// memory. A client and a server socket are connected over loopback inside
+// one io_context and bounce a message back and forth the way client and
+// server do; every operator new while they run is counted.
+//
+// Asio keeps a small per-thread cache of operation blocks of its own, which
+// hides most allocations as long as the thread that completes an operation
+// is the one that starts the next. alloc_bench_no_cache is built with that
+// cache disabled and shows what each operation costs without it.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#include <boost/asio.hpp>
+
+#include "handler_memory.h"
+
+namespace sys = boost::system;
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+static std::atomic<unsigned long> allocations (0);
+
+void *
+operator new (std::size_t size)
+{
+  allocations.fetch_add (1, std::memory_order_relaxed);
+  if (void *p = std::malloc (size ? size : 1))
+    return p;
+  throw std::bad_alloc ();
+}
+
+// Out of line, so that the compiler does not pair the free () in here
+// with the malloc () in operator new and warn about a mismatch.
+__attribute__ ((noinline)) void
+operator delete (void *p) noexcept
+{
+  std::free (p);
+}
+
+__attribute__ ((noinline)) void
+operator delete (void *p, std::size_t) noexcept
+{
+  std::free (p);
+}
+
+template <bool Recycle>
+class echo_loop
+{
+public:
+  echo_loop (asio::io_context &io, tcp::socket &client, tcp::socket &server)
+      : io_ (io), client_ (client), server_ (server), left_ (0)
+  {
+    std::memset (message_, 'x', sizeof message_);
+    serve ();
+  }
+
+  // Stops io after round_trips echoes; the server side keeps its receive
+  // pending for the next call.
+  void
+  bounce (unsigned long round_trips)
+  {
+    left_ = round_trips;
+    send ();
+  }
+
+private:
+  using recycle = std::integral_constant<bool, Recycle>;
+
+  template <typename Handler>
+  static Handler
+  bind (handler_memory<> &, Handler handler, std::false_type)
+  {
+    return handler;
+  }
+
+  template <typename Handler>
+  static auto
+  bind (handler_memory<> &memory, Handler handler, std::true_type)
+      -> decltype (bind_handler_memory (memory, handler))
+  {
+    return bind_handler_memory (memory, handler);
+  }
+
+  void
+  send ()
+  {
+    auto handle_write = [this] (const sys::error_code &ec, std::size_t) {
+      if (!ec)
+	receive ();
+    };
+    asio::async_write (client_, asio::buffer (message_),
+		       bind (client_memory_, handle_write, recycle ()));
+  }
+
+  void
+  receive ()
+  {
+    auto handle_read = [this] (const sys::error_code &ec, std::size_t) {
+      if (ec)
+	return;
+      if (--left_ == 0)
+	io_.stop ();
+      else
+	send ();
+    };
+    asio::async_read (client_, asio::buffer (reply_),
+		      bind (client_memory_, handle_read, recycle ()));
+  }
+
+  void
+  serve ()
+  {
+    auto handle_write = [this] (const sys::error_code &ec, std::size_t) {
+      if (!ec)
+	serve ();
+    };
+    auto handle_receive = [this, handle_write] (const sys::error_code &ec,
+						std::size_t n) {
+      if (!ec)
+	asio::async_write (server_, asio::buffer (buffer_, n),
+			   bind (server_memory_, handle_write, recycle ()));
+    };
+    server_.async_receive (asio::buffer (buffer_),
+			   bind (server_memory_, handle_receive, recycle ()));
+  }
+
+  asio::io_context &io_;
+  tcp::socket &client_;
+  tcp::socket &server_;
+  unsigned long left_;
+  char message_[64];
+  char reply_[64];
+  char buffer_[1024];
+  handler_memory<> client_memory_;
+  handler_memory<> server_memory_;
+};
+
+template <bool Recycle>
+static double
+allocations_per_round_trip (unsigned long round_trips)
+{
+  asio::io_context io (1);
+  tcp::acceptor acceptor (io, tcp::endpoint (asio::ip::address_v4::loopback (),
+					     0));
+  tcp::socket client (io);
+  tcp::socket server (io);
+  client.connect (acceptor.local_endpoint ());
+  acceptor.accept (server);
+
+  echo_loop<Recycle> loop (io, client, server);
+
+  // The first round trip grows the reactor's per-socket state; leave it
+  // out of the count.
+  loop.bounce (1);
+  io.run ();
+  io.restart ();
+
+  unsigned long before = allocations.load ();
+  loop.bounce (round_trips);
+  io.run ();
+  unsigned long after = allocations.load ();
+
+  // The server's receive is still pending in loop's handler memory; let it
+  // complete before loop goes, rather than be destroyed with io into freed
+  // memory.
+  client.close ();
+  server.close ();
+  io.restart ();
+  io.run ();
+
+  return double (after - before) / round_trips;
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned long round_trips = argc > 1 ? std::strtoul (argv[1], nullptr, 10)
+				       : 100000;
+  if (round_trips == 0)
+    {
+      std::fprintf (stderr, "Usage: %s [round trips]\n", argv[0]);
+      return 1;
+    }
+
+  std::printf ("plain:    %.3f allocations per round trip\n",
+	       allocations_per_round_trip<false> (round_trips));
+  std::printf ("recycled: %.3f allocations per round trip\n",
+	       allocations_per_round_trip<true> (round_trips));
+}
@@ -1,18 +1,30 @@
+#include <cstring>
 #include <thread>
 
 #include <boost/asio.hpp>
 
+#include "latency_histogram.h"
+
 namespace sys = boost::system;
 namespace asio = boost::asio;
 using asio::ip::tcp;
 
 int connections;
+int first_port = 8080;
+int num_ports = 10;
+int duration = 0;
+int interval_ms = 1000;
 std::atomic<bool> stop;
 std::atomic<int> echoes;
 std::atomic<int> failed;
 std::atomic<int> connected;
 std::atomic<int> completed;
 
+// Start of the load phase, once all connections are established, and the
+// echo count then; set by the monitor.
+std::chrono::steady_clock::time_point load_begin;
+int load_echoes;
+
 void monitor ();
 
 void
@@ -27,15 +39,17 @@ class session : public std::enable_shared_from_this<session>
 public:
   using pointer = std::shared_ptr<session>;
 
-  explicit session (asio::io_context &io)
-      : socket_ (io, tcp::v4 ()), timer_ (io)
+  // Round trips are recorded into latency, which must only be touched by
+  // the thread running io.
+  session (asio::io_context &io, latency_histogram &latency)
+      : socket_ (io, tcp::v4 ()), timer_ (io), latency_ (latency)
   {
   }
 
   static pointer
-  make (asio::io_context &io)
+  make (asio::io_context &io, latency_histogram &latency)
   {
-    return std::make_shared<session> (io);
+    return std::make_shared<session> (io, latency);
   }
 
   void
@@ -53,6 +67,7 @@ private:
   {
     send_buffer_ = "Hello world!";
     recv_buffer_.resize (send_buffer_.size ());
+    sent_at_ = std::chrono::steady_clock::now ();
 
     auto self = shared_from_this ();
     asio::async_write (socket_, asio::buffer (send_buffer_),
@@ -101,9 +116,18 @@ private:
 
     if (recv_buffer_ == send_buffer_)
       echoes++;
+    latency_.record (std::chrono::duration_cast<std::chrono::nanoseconds> (
+			 std::chrono::steady_clock::now () - sent_at_)
+			 .count ());
+
+    if (interval_ms == 0)
+      {
+	start ();
+	return;
+      }
 
     auto self = shared_from_this ();
-    timer_.expires_after (asio::chrono::seconds (1));
+    timer_.expires_after (asio::chrono::milliseconds (interval_ms));
     timer_.async_wait ([this, self] (const sys::error_code &ec)
 			 { handle_wait (ec); });
   }
@@ -125,14 +149,55 @@ private:
   std::string send_buffer_;
   std::string recv_buffer_;
   asio::steady_timer timer_;
+  latency_histogram &latency_;
+  std::chrono::steady_clock::time_point sent_at_;
 };
 
+static void
+usage (const char *prog)
+{
+  printf ("Usage: %s <connections> [options]\n"
+	  "  --duration S     stop after S seconds of load (default: ^C)\n"
+	  "  --interval-ms N  pause between echoes per connection, 0 for\n"
+	  "                   back to back (default: 1000)\n"
+	  "  --port P         first server port (default: 8080)\n"
+	  "  --ports N        number of consecutive ports (default: 10)\n",
+	  prog);
+}
+
+static bool
+parse (int argc, char **argv)
+{
+  if (argc < 2)
+    return false;
+  connections = std::atoi (argv[1]);
+
+  for (int i = 2; i < argc; i++)
+    {
+      bool has_value = i + 1 < argc;
+
+      if (!std::strcmp (argv[i], "--duration") && has_value)
+	duration = std::atoi (argv[++i]);
+      else if (!std::strcmp (argv[i], "--interval-ms") && has_value)
+	interval_ms = std::atoi (argv[++i]);
+      else if (!std::strcmp (argv[i], "--port") && has_value)
+	first_port = std::atoi (argv[++i]);
+      else if (!std::strcmp (argv[i], "--ports") && has_value)
+	num_ports = std::atoi (argv[++i]);
+      else
+	return false;
+    }
+
+  return connections > 0 && num_ports > 0 && duration >= 0
+	 && interval_ms >= 0;
+}
+
 int
 main (int argc, char **argv)
 {
-  if (argc != 2)
+  if (!parse (argc, argv))
     {
-      printf ("Usage: %s <connections>\n", argv[0]);
+      usage (argv[0]);
       return 1;
     }
 
@@ -147,24 +212,25 @@ main (int argc, char **argv)
 		}
 	    });
 
-  connections = std::atoi (argv[1]);
   std::vector<std::thread> echo_thrds;
-  std::vector<asio::io_context> ctxs (10);
+  std::vector<asio::io_context> ctxs (num_ports);
+  std::vector<latency_histogram> latencies (num_ports);
 
-  for (int i = 0; i < 10; i++)
+  for (int i = 0; i < num_ports; i++)
     {
       auto &io = ctxs[i];
-      short port = 8080 + i;
+      auto &latency = latencies[i];
+      short port = first_port + i;
       echo_thrds.emplace_back (
-	  [&io, port] ()
+	  [&io, &latency, port] ()
 	    {
 	      try
 		{
-		  int conns = connections / 10;
-		  conns += !!(connections % 10);
+		  int conns = connections / num_ports;
+		  conns += !!(connections % num_ports);
 
 		  for (int j = 0; j < conns; j++)
-		    session::make (io)->start (port);
+		    session::make (io, latency)->start (port);
 
 		  io.run ();
 		}
@@ -180,11 +246,30 @@ main (int argc, char **argv)
   for (; !stop;)
     std::this_thread::sleep_for (std::chrono::milliseconds (100));
 
+  auto load_end = std::chrono::steady_clock::now ();
+  int echoes_end = echoes.load ();
+
   for (auto &io : ctxs)
     io.stop ();
   for (auto &thrd : echo_thrds)
     thrd.join ();
   monitor_thrd.join ();
+
+  // One machine-readable line for scripts such as compare_backends.py.
+  latency_histogram latency;
+  for (const auto &l : latencies)
+    latency.merge (l);
+
+  int load_total = echoes_end - load_echoes;
+  double seconds
+      = std::chrono::duration<double> (load_end - load_begin).count ();
+  if (load_begin == std::chrono::steady_clock::time_point{} || seconds <= 0)
+    seconds = 0;
+  printf ("summary: echoes=%d seconds=%.3f rate=%.0f p50_us=%.1f "
+	  "p99_us=%.1f max_us=%.1f failed=%d\n",
+	  load_total, seconds, seconds ? load_total / seconds : 0.0,
+	  latency.percentile (50) / 1e3, latency.percentile (99) / 1e3,
+	  latency.max () / 1e3, failed.load ());
 }
 
 void
@@ -197,8 +282,8 @@ monitor ()
       puts ("");
     };
 
-  printf ("Target: 127.0.0.1:8080-8089 | Total Connections: %d\n",
-	  connections);
+  printf ("Target: 127.0.0.1:%d-%d | Total Connections: %d\n", first_port,
+	  first_port + num_ports - 1, connections);
   print_line ();
 
   auto start = std::chrono::steady_clock::now ();
@@ -218,6 +303,9 @@ monitor ()
     return;
   print_line ();
 
+  load_echoes = echoes.load ();
+  load_begin = std::chrono::steady_clock::now ();
+
   const char *fmt = "Active: %6d | "
 		    "Failed: %6d | "
 		    "Echoes: %9d | "
@@ -238,6 +326,12 @@ monitor ()
 
       printf (fmt, connected.load (), failed.load (), now, rate);
       std::this_thread::sleep_for (std::chrono::seconds (1));
+
+      if (duration && times + 1 >= duration)
+	{
+	  stop = true;
+	  break;
+	}
     }
 
   print_line ();
@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Runs the same echo load against the epoll and io_uring builds.
+
+Configure asio/echo (and asio/proxy for the proxy rows) with
+-DASIO_IO_URING=ON so that every program also has a *_uring twin, then:
+
+    ./compare_backends.py --echo-build build --proxy-build ../proxy/build
+
+For each server variant and backend the server is started, loaded by the
+epoll client for --duration seconds, and its CPU time read from /proc.
+Reported per run: echoes per second, p50 and p99 round-trip latency, and
+server CPU microseconds per echo. Proxy rows put the proxy under test in
+front of an epoll echo server.
+"""
+
+import argparse
+import json
+import os
+import re
+import signal
+import socket
+import subprocess
+import sys
+import time
+
+FIRST_PORT = 8080
+NUM_PORTS = 10
+PROXY_PORT = 9080
+BACKENDS = {"epoll": "", "io_uring": "_uring"}
+SUMMARY = re.compile(r"summary: (.*)")
+
+
+def cpu_seconds(pid):
+    with open(f"/proc/{pid}/stat") as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    # utime and stime are fields 14 and 15; fields[0] here is field 3.
+    ticks = int(fields[11]) + int(fields[12])
+    return ticks / os.sysconf("SC_CLK_TCK")
+
+
+def wait_for_port(port, timeout=5.0):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            with socket.create_connection(("127.0.0.1", port), timeout=0.2):
+                return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def stop(proc):
+    proc.send_signal(signal.SIGINT)
+    try:
+        proc.wait(timeout=5)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+        proc.wait()
+
+
+def run_client(client, args, port, ports):
+    cmd = [client, str(args.connections),
+           "--duration", str(args.duration),
+           "--interval-ms", str(args.interval_ms),
+           "--port", str(port), "--ports", str(ports)]
+    out = subprocess.run(cmd, capture_output=True, text=True,
+                         timeout=args.duration + 60).stdout
+    match = SUMMARY.search(out)
+    if not match:
+        raise RuntimeError(f"no summary from client:\n{out}")
+    return {k: float(v) for k, v in
+            (kv.split("=") for kv in match.group(1).split())}
+
+
+def measure(name, backend, server_cmd, args, client, extra=None):
+    """Loads server_cmd and returns one result row; extra processes are
+    started first and stopped last (the proxy's echo server)."""
+    helpers = [subprocess.Popen(cmd, stdout=subprocess.DEVNULL)
+               for cmd in (extra or [])]
+    server = subprocess.Popen(server_cmd, stdout=subprocess.DEVNULL)
+    try:
+        port, ports = (PROXY_PORT, 1) if extra else (FIRST_PORT, NUM_PORTS)
+        if not wait_for_port(port) or not wait_for_port(FIRST_PORT):
+            raise RuntimeError(f"{server_cmd[0]} did not start listening")
+
+        cpu_before = cpu_seconds(server.pid)
+        summary = run_client(client, args, port, ports)
+        cpu_after = cpu_seconds(server.pid)
+    finally:
+        stop(server)
+        for helper in helpers:
+            stop(helper)
+
+    echoes = summary["echoes"]
+    return {
+        "server": name,
+        "backend": backend,
+        "echoes": int(echoes),
+        "rate": summary["rate"],
+        "p50_us": summary["p50_us"],
+        "p99_us": summary["p99_us"],
+        "cpu_us_per_echo":
+            (cpu_after - cpu_before) * 1e6 / echoes if echoes else 0.0,
+        "failed": int(summary["failed"]),
+    }
+
+
+def variants(args):
+    """Yields (name, backend, server command, helper commands)."""
+    for backend, suffix in BACKENDS.items():
+        for name in args.servers:
+            if name == "proxy":
+                if not args.proxy_build:
+                    continue
+                binary = os.path.join(args.proxy_build, "server" + suffix)
+                echo = os.path.join(args.echo_build, "server")
+                cmd = [binary, "127.0.0.1", str(PROXY_PORT),
+                       "127.0.0.1", str(FIRST_PORT)]
+                helpers = [[echo]]
+            else:
+                binary = os.path.join(args.echo_build, name + suffix)
+                cmd = [binary] + (["--per-core"] if args.per_core
+                                  and name == "server" else [])
+                helpers = None
+
+            if not os.access(binary, os.X_OK):
+                print(f"skipping {name} ({backend}): {binary} not built",
+                      file=sys.stderr)
+                continue
+            yield name, backend, cmd, helpers
+
+
+def print_table(rows):
+    header = ("server", "backend", "echo/s", "p50 us", "p99 us",
+              "cpu us/echo", "failed")
+    print("%-10s %-9s %12s %9s %9s %12s %7s" % header)
+    for r in rows:
+        print("%-10s %-9s %12.0f %9.1f %9.1f %12.2f %7d" % (
+            r["server"], r["backend"], r["rate"], r["p50_us"],
+            r["p99_us"], r["cpu_us_per_echo"], r["failed"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--echo-build", default="build",
+                        help="build directory of asio/echo")
+    parser.add_argument("--proxy-build",
+                        help="build directory of asio/proxy")
+    parser.add_argument("--servers", default="server,co_server,proxy",
+                        help="comma-separated: server,co_server,proxy")
+    parser.add_argument("--per-core", action="store_true",
+                        help="run server in its --per-core mode")
+    parser.add_argument("--connections", type=int, default=100)
+    parser.add_argument("--duration", type=int, default=10)
+    parser.add_argument("--interval-ms", type=int, default=0,
+                        help="pause between echoes, 0 for closed loop")
+    parser.add_argument("--runs", type=int, default=1,
+                        help="repeat every measurement this many times")
+    parser.add_argument("--json", action="store_true")
+    args = parser.parse_args()
+    args.servers = args.servers.split(",")
+
+    client = os.path.join(args.echo_build, "client")
+    if not os.access(client, os.X_OK):
+        sys.exit(f"{client} not built")
+
+    rows = []
+    for name, backend, cmd, helpers in variants(args):
+        for _ in range(args.runs):
+            rows.append(measure(name, backend, cmd, args, client, helpers))
+
+    if args.json:
+        print(json.dumps(rows, indent=2))
+    else:
+        print_table(rows)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,190 +1,587 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
 #include <list>
+#include <memory>
+
+#include <pthread.h>
+#include <sched.h>
 
 #include <boost/asio.hpp>
 
+#include "handler_memory.h"
+#include "object_pool.h"
+#include "splice_pipe.h"
+#include "timing_wheel.h"
+
 namespace sys = boost::system;
 namespace asio = boost::asio;
 namespace chrono = asio::chrono;
 using asio::ip::tcp;
 
 constexpr chrono::seconds default_timeout (5);
-constexpr size_t buffer_size = 1024;
+
+// Echo output a pipelining session may have queued before it stops reading
+// from its client.
+constexpr size_t pipeline_limit = 256 * 1024;
+
+// Reads go into pooled blocks of block_size; a session reads into one block
+// at first and into up to max_read_blocks as long as it keeps filling them.
+constexpr size_t block_size = 4096;
+constexpr size_t max_read_blocks = 16;
+
+struct buffer_block
+{
+  std::array<char, block_size> data;
+
+  // Set while the block is queued for writing.
+  size_t size;
+  buffer_block *next;
+};
+
+using block_pool = object_pool<buffer_block>;
+
+// The first size buffers of an array, as a buffer sequence for scatter
+// reads and gather writes. The array must outlive the operation.
+template <typename Buffer>
+struct buffer_prefix
+{
+  using value_type = Buffer;
+  using const_iterator = const Buffer *;
+
+  const Buffer *first;
+  size_t size;
+
+  const_iterator
+  begin () const
+  {
+    return first;
+  }
+
+  const_iterator
+  end () const
+  {
+    return first + size;
+  }
+};
+
+// The first count blocks of a chain, as a buffer sequence for gather
+// writes, less the first offset bytes of the first block. Iterating never
+// reads the next pointer of the last block, so blocks may be appended to
+// the chain while a write of it is in flight.
+class block_chain
+{
+public:
+  class const_iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = asio::const_buffer;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const asio::const_buffer *;
+    using reference = asio::const_buffer;
+
+    const_iterator (const buffer_block *block, size_t offset, size_t index,
+		    size_t count)
+	: block_ (block), offset_ (offset), index_ (index), count_ (count)
+    {
+    }
+
+    asio::const_buffer
+    operator* () const
+    {
+      return asio::buffer (block_->data.data () + offset_,
+			   block_->size - offset_);
+    }
+
+    const_iterator &
+    operator++ ()
+    {
+      block_ = ++index_ < count_ ? block_->next : nullptr;
+      offset_ = 0;
+      return *this;
+    }
+
+    const_iterator
+    operator++ (int)
+    {
+      const_iterator old = *this;
+      ++*this;
+      return old;
+    }
+
+    friend bool
+    operator== (const const_iterator &a, const const_iterator &b)
+    {
+      return a.index_ == b.index_;
+    }
+
+    friend bool
+    operator!= (const const_iterator &a, const const_iterator &b)
+    {
+      return a.index_ != b.index_;
+    }
+
+  private:
+    const buffer_block *block_;
+    size_t offset_;
+    size_t index_;
+    size_t count_;
+  };
+
+  using value_type = asio::const_buffer;
+
+  block_chain (const buffer_block *first, size_t offset, size_t count)
+      : first_ (first), offset_ (offset), count_ (count)
+  {
+  }
+
+  const_iterator
+  begin () const
+  {
+    return const_iterator (first_, offset_, 0, count_);
+  }
+
+  const_iterator
+  end () const
+  {
+    return const_iterator (nullptr, 0, count_, count_);
+  }
+
+private:
+  const buffer_block *first_;
+  size_t offset_;
+  size_t count_;
+};
+
+// Every idle pipe holds two descriptors that accept () could use, so
+// keep only a few: at most four per thread and eight more shared.
+using pipe_pool = object_pool<splice_pipe, 8, 2>;
+
+using reuse_port
+    = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+struct session_options
+{
+  // With max_pending zero a session strictly alternates reading and
+  // writing. Otherwise it keeps reading while its echo is being written,
+  // queuing up to max_pending bytes, and each write sends all that has
+  // been queued since the previous one.
+  size_t max_pending = 0;
+
+  // Echo with splice (2) through a pipe instead of reading into and
+  // writing out of user-space blocks. Reading and writing then strictly
+  // alternate; where splice is not supported, the session copies.
+  bool zero_copy = false;
+};
+
+class session;
+
+using idle_wheel = timing_wheel<session>;
 
 class session : public std::enable_shared_from_this<session>
 {
 public:
   using pointer = std::shared_ptr<session>;
 
+  // A session whose io_context is run by a single thread never has two
+  // handlers in flight at once, so it can do without a strand.
   static pointer
-  make (tcp::socket sock,
-	chrono::steady_clock::duration timeout = default_timeout)
+  make (tcp::socket sock, idle_wheel &wheel,
+	const session_options &options = session_options (),
+	bool use_strand = true)
+  {
+    asio::any_io_executor ex = sock.get_executor ();
+    if (use_strand)
+      ex = asio::make_strand (ex);
+    return std::make_shared<session> (std::move (sock), ex, wheel, options);
+  }
+
+  session (tcp::socket sock, asio::any_io_executor ex, idle_wheel &wheel,
+	   const session_options &options = session_options ())
+      : socket_ (std::move (sock)), executor_ (std::move (ex)),
+	wheel_ (wheel), last_activity_ (wheel.now ()),
+	max_pending_ (options.max_pending), splice_ (options.zero_copy)
   {
-    return std::make_shared<session> (std::move (sock), timeout);
   }
 
-  explicit session (tcp::socket sock,
-		    chrono::steady_clock::duration timeout = default_timeout)
-      : socket_ (std::move (sock)), timeout_ (timeout)
+  ~session ()
   {
+    while (head_)
+      pop_front ();
+    if (pipe_ && pipe_->size ())
+      pipe_->reset ();
   }
 
+  // The session closes once it has had no receive or write to start for
+  // the wheel's timeout.
   void
-  start (bool with_timeout = true)
+  start ()
   {
-    if (with_timeout)
-      receive_with_timeout ();
-    else
-      {
-	receive_with_watchdog ();
-	start_watchdog ();
-      }
+    sys::error_code error;
+    socket_.non_blocking (true, error);
+    if (error)
+      return;
+
+    wheel_.add (shared_from_this ());
+    wait_readable ();
   }
 
 private:
+  friend class timing_wheel<session>;
+
+  // The read and the write chain each have at most one operation in
+  // flight, so each gets one recycled handler block. Their operations
+  // take well under 384 bytes, a fraction of the default, which matters
+  // with many idle sessions.
+  using chain_memory = handler_memory<384>;
+
+  template <typename Handler>
+  auto
+  bind_handler (chain_memory &memory, Handler handler)
+      -> decltype (bind_handler_memory (
+	  memory,
+	  asio::bind_executor (std::declval<asio::any_io_executor &> (),
+			       handler)))
+  {
+    return bind_handler_memory (memory,
+				asio::bind_executor (executor_, handler));
+  }
+
+  idle_wheel::tick_type
+  last_activity () const noexcept
+  {
+    return last_activity_.load (std::memory_order_relaxed);
+  }
+
+  void
+  touch () noexcept
+  {
+    last_activity_.store (wheel_.now (), std::memory_order_relaxed);
+  }
+
+  // Called by the wheel, possibly from another thread.
+  void
+  expire ()
+  {
+    auto self = shared_from_this ();
+    asio::dispatch (executor_, [self] () { self->stop (); });
+  }
+
   void
   stop ()
   {
     socket_.close ();
-    timer_.cancel ();
   }
 
+  // An idle session holds no buffers: it waits for data to arrive and
+  // only then borrows blocks from the pool to read it into.
   void
-  receive_with_watchdog ()
+  wait_readable ()
   {
     auto self = shared_from_this ();
-    auto handle_receive = [self] (const sys::error_code &error, size_t bytes)
+    auto handle_wait = [self] (const sys::error_code &error)
       {
 	if (error)
 	  {
 	    self->stop ();
 	    return;
 	  }
-	self->send_with_watchdog (bytes);
+	if (self->splice_)
+	  self->splice_receive ();
+	else
+	  self->receive ();
       };
 
-    socket_.async_receive (asio::buffer (buffer_),
-			   asio::bind_executor (strand_, handle_receive));
+    reading_ = true;
+    socket_.async_wait (tcp::socket::wait_read,
+			bind_handler (read_memory_, handle_wait));
+    touch ();
+  }
+
+  void
+  receive ()
+  {
+    for (;;)
+      {
+	std::array<block_pool::pointer, max_read_blocks> blocks;
+	std::array<asio::mutable_buffer, max_read_blocks> buffers;
+	for (size_t i = 0; i < read_blocks_; i++)
+	  {
+	    blocks[i] = block_pool::acquire ();
+	    buffers[i] = asio::buffer (blocks[i]->data);
+	  }
+
+	sys::error_code error;
+	size_t bytes = socket_.read_some (
+	    buffer_prefix<asio::mutable_buffer>{ buffers.data (),
+						 read_blocks_ },
+	    error);
+	if (error == asio::error::would_block)
+	  {
+	    wait_readable ();
+	    return;
+	  }
+	if (error)
+	  {
+	    // The client has stopped sending; close once its echo is out.
+	    reading_ = false;
+	    read_done_ = true;
+	    if (!writing_)
+	      stop ();
+	    return;
+	  }
+
+	for (size_t i = 0; i * block_size < bytes; i++)
+	  push_back (std::move (blocks[i]),
+		     std::min (block_size, bytes - i * block_size));
+
+	bool filled = bytes == read_blocks_ * block_size;
+	size_t used = (bytes + block_size - 1) / block_size;
+	if (filled)
+	  read_blocks_ = std::min (2 * read_blocks_, max_read_blocks);
+	else if (2 * used <= read_blocks_)
+	  read_blocks_ = std::max (read_blocks_ / 2, size_t (1));
+
+	send ();
 
-    deadline_ = chrono::steady_clock::now () + timeout_;
+	// Too much output queued: the write that drains it resumes reading.
+	if (pending_bytes_ > max_pending_)
+	  {
+	    reading_ = false;
+	    return;
+	  }
+
+	// A read that filled every block likely left more data behind.
+	if (!filled)
+	  {
+	    wait_readable ();
+	    return;
+	  }
+      }
   }
 
+  // Writes everything queued, unless a write is already in flight.
   void
-  send_with_watchdog (size_t bytes_to_send)
+  send ()
   {
+    if (writing_ || !head_)
+      return;
+
     auto self = shared_from_this ();
-    auto handle_write = [self] (const sys::error_code &error, size_t /*bytes*/)
+    auto handle_write = [self] (const sys::error_code &error, size_t bytes)
       {
+	self->writing_ = false;
 	if (error)
 	  {
 	    self->stop ();
 	    return;
 	  }
-	self->receive_with_watchdog ();
+	self->written (bytes);
       };
 
-    asio::async_write (socket_, asio::buffer (buffer_, bytes_to_send),
-		       asio::bind_executor (strand_, handle_write));
-
-    deadline_ = chrono::steady_clock::now () + timeout_;
+    writing_ = true;
+    socket_.async_write_some (
+	block_chain (head_, head_offset_, queued_blocks_),
+	bind_handler (write_memory_, handle_write));
+    touch ();
   }
 
   void
-  start_watchdog ()
+  written (size_t bytes)
   {
-    auto now = chrono::steady_clock::now ();
-    if (now >= deadline_)
+    pending_bytes_ -= bytes;
+    while (bytes)
       {
-	stop ();
-	return;
+	size_t left = head_->size - head_offset_;
+	if (bytes < left)
+	  {
+	    head_offset_ += bytes;
+	    break;
+	  }
+	bytes -= left;
+	pop_front ();
       }
 
-    auto self = shared_from_this ();
-    auto handle_wait = [self] (const sys::error_code &error)
+    if (head_)
+      send ();
+    else if (read_done_)
       {
-	if (!error)
-	  self->start_watchdog ();
-      };
+	stop ();
+	return;
+      }
 
-    timer_.expires_at (deadline_);
-    timer_.async_wait (asio::bind_executor (strand_, handle_wait));
+    if (!reading_ && !read_done_ && pending_bytes_ <= max_pending_)
+      wait_readable ();
   }
 
+  // The zero-copy path: all that is readable goes into a pipe borrowed
+  // for the purpose, and back out to the socket from there.
   void
-  receive_with_timeout ()
+  splice_receive ()
   {
-    auto self = shared_from_this ();
-    auto handle_receive = [self] (const sys::error_code &error, size_t bytes)
+    if (!pipe_)
+      pipe_ = pipe_pool::acquire ();
+    if (!pipe_->ensure_open ())
       {
-	self->timer_.cancel ();
-	if (error)
-	  {
-	    self->stop ();
-	    return;
-	  }
-	self->send_with_timeout (bytes);
-      };
+	// Out of descriptors for now: copy this time round.
+	pipe_.reset ();
+	receive ();
+	return;
+      }
 
-    socket_.async_receive (asio::buffer (buffer_),
-			   asio::bind_executor (strand_, handle_receive));
+    sys::error_code error;
+    pipe_->fill (socket_.native_handle (), error);
+    if (error == asio::error::would_block)
+      {
+	pipe_.reset ();
+	wait_readable ();
+	return;
+      }
+    if (error == asio::error::invalid_argument)
+      {
+	// The socket cannot be spliced; nothing has been moved.
+	pipe_.reset ();
+	splice_ = false;
+	receive ();
+	return;
+      }
+    if (error)
+      {
+	pipe_.reset ();
+	stop ();
+	return;
+      }
 
-    start_timeout ();
+    splice_send ();
   }
 
   void
-  send_with_timeout (size_t bytes_to_send)
+  splice_send ()
   {
+    sys::error_code error;
+    while (pipe_->size () && !error)
+      pipe_->drain (socket_.native_handle (), error);
+
+    if (!error)
+      {
+	pipe_.reset ();
+	wait_readable ();
+	return;
+      }
+
+    if (error != asio::error::would_block)
+      {
+	discard_pipe ();
+	stop ();
+	return;
+      }
+
     auto self = shared_from_this ();
-    auto handle_write = [self] (const sys::error_code &error, size_t /*bytes*/)
+    auto handle_wait = [self] (const sys::error_code &error)
       {
-	self->timer_.cancel ();
 	if (error)
 	  {
+	    self->discard_pipe ();
 	    self->stop ();
 	    return;
 	  }
-	self->receive_with_timeout ();
+	self->splice_send ();
       };
 
-    asio::async_write (socket_, asio::buffer (buffer_, bytes_to_send),
-		       asio::bind_executor (strand_, handle_write));
+    socket_.async_wait (tcp::socket::wait_write,
+			bind_handler (write_memory_, handle_wait));
+    touch ();
+  }
 
-    start_timeout ();
+  // Hands back a pipe that may still hold data, emptied.
+  void
+  discard_pipe ()
+  {
+    pipe_->reset ();
+    pipe_.reset ();
   }
 
   void
-  start_timeout ()
+  push_back (block_pool::pointer block, size_t size)
   {
-    auto self = shared_from_this ();
-    auto handle_wait = [self] (const sys::error_code &error)
-      {
-	if (!error)
-	  self->stop ();
-      };
+    buffer_block *b = block.release ();
+    b->size = size;
+    b->next = nullptr;
+    if (tail_)
+      tail_->next = b;
+    else
+      head_ = b;
+    tail_ = b;
+    queued_blocks_++;
+    pending_bytes_ += size;
+  }
 
-    timer_.expires_after (timeout_);
-    timer_.async_wait (asio::bind_executor (strand_, handle_wait));
+  void
+  pop_front ()
+  {
+    block_pool::pointer block{ head_ };
+    head_ = head_->next;
+    if (!head_)
+      tail_ = nullptr;
+    head_offset_ = 0;
+    queued_blocks_--;
   }
 
 private:
   tcp::socket socket_;
-  asio::steady_timer timer_{ socket_.get_executor () };
-  asio::strand<asio::any_io_executor> strand_{ socket_.get_executor () };
-
-  asio::steady_timer::time_point deadline_;
-  chrono::steady_clock::duration timeout_;
-  std::array<char, buffer_size> buffer_;
+  asio::any_io_executor executor_;
+  chain_memory read_memory_;
+  chain_memory write_memory_;
+
+  idle_wheel &wheel_;
+  std::atomic<idle_wheel::tick_type> last_activity_;
+
+  size_t read_blocks_ = 1;
+  bool reading_ = false;
+  bool read_done_ = false;
+  bool writing_ = false;
+
+  // Echo output waiting to be written, oldest first; head_offset_ bytes of
+  // the first block have been written already.
+  buffer_block *head_ = nullptr;
+  buffer_block *tail_ = nullptr;
+  size_t head_offset_ = 0;
+  size_t queued_blocks_ = 0;
+  size_t pending_bytes_ = 0;
+  size_t max_pending_;
+
+  // Held only while spliced data is in flight.
+  bool splice_;
+  pipe_pool::pointer pipe_;
 };
 
 class server
 {
 public:
-  server (asio::any_io_executor ex, const tcp::endpoint &ep)
-      : acceptor_ (ex, ep)
+  // With per_core set, the listening socket is one of several bound to
+  // the same port with SO_REUSEPORT, each on its own single-threaded
+  // io_context; the kernel spreads connections across them.
+  server (asio::any_io_executor ex, const tcp::endpoint &ep,
+	  idle_wheel &wheel, const session_options &options,
+	  bool per_core = false)
+      : acceptor_ (ex), wheel_ (wheel), options_ (options),
+	per_core_ (per_core)
   {
+    acceptor_.open (ep.protocol ());
+    acceptor_.set_option (tcp::acceptor::reuse_address (true));
+    if (per_core_)
+      acceptor_.set_option (reuse_port (true));
+    acceptor_.bind (ep);
+    acceptor_.listen ();
   }
 
-  server (asio::any_io_executor ex, short port)
-      : server (ex, tcp::endpoint (tcp::v4 (), port))
+  server (asio::any_io_executor ex, short port, idle_wheel &wheel,
+	  const session_options &options, bool per_core = false)
+      : server (ex, tcp::endpoint (tcp::v4 (), port), wheel, options,
+		per_core)
   {
   }
 
@@ -197,8 +594,9 @@ public:
 	if (error)
 	  return;
 
-	auto sess = session::make (std::move (sock));
-	sess->start (false);
+	auto sess = session::make (std::move (sock), wheel_, options_,
+				   !per_core_);
+	sess->start ();
 
 	start ();
       };
@@ -208,44 +606,190 @@ public:
 
 private:
   tcp::acceptor acceptor_;
+  idle_wheel &wheel_;
+  session_options options_;
+  bool per_core_;
 };
 
-int
-main ()
+constexpr short first_port = 8080;
+constexpr int num_ports = 10;
+
+static void
+run_context (asio::io_context &io_context)
 {
   try
     {
-      asio::io_context io_context;
-      asio::signal_set signals (io_context, SIGINT, SIGTERM);
-      std::list<server> servers;
-      std::vector<std::thread> threads;
-
-      signals.async_wait ([&] (const sys::error_code & /*error*/,
-			       int /*signum*/) { io_context.stop (); });
-
-      auto executor = io_context.get_executor ();
-      for (int i = 0; i < 10; i++)
-	servers.emplace (servers.end (), executor, 8080 + i)->start ();
-
-      unsigned int num_threads = std::thread::hardware_concurrency ();
-      num_threads = num_threads ? num_threads * 2 : 10;
-      for (unsigned int i = 0; i < num_threads; i++)
-	threads.emplace_back (
-	    [&io_context] ()
-	      {
-		try
-		  {
-		    io_context.run ();
-		  }
-		catch (const std::exception &e)
-		  {
-		    std::printf ("exception: %s\n", e.what ());
-		  }
-	      });
-
       io_context.run ();
-      for (auto &thrd : threads)
-	thrd.join ();
+    }
+  catch (const std::exception &e)
+    {
+      std::printf ("exception: %s\n", e.what ());
+    }
+}
+
+static std::vector<int>
+allowed_cpus ()
+{
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  if (sched_getaffinity (0, sizeof set, &set) == 0)
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET (cpu, &set))
+	cpus.push_back (cpu);
+  return cpus;
+}
+
+// A thread that cannot be pinned still serves its io_context, but says so
+// rather than pass for placed.
+static void
+pin_this_thread (int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  CPU_SET (cpu, &set);
+  int error = pthread_setaffinity_np (pthread_self (), sizeof set, &set);
+  if (error)
+    std::printf ("cannot pin thread to CPU %d, running unpinned: %s\n", cpu,
+		 std::strerror (error));
+}
+
+// One io_context shared by all threads: every completion goes through the
+// same scheduler queue, and sessions serialize on strands.
+static void
+run_shared (unsigned int num_threads, const session_options &options)
+{
+  asio::io_context io_context;
+  asio::signal_set signals (io_context, SIGINT, SIGTERM);
+  idle_wheel wheel (io_context.get_executor (), default_timeout);
+  std::list<server> servers;
+  std::vector<std::thread> threads;
+
+  signals.async_wait ([&] (const sys::error_code & /*error*/,
+			   int /*signum*/) { io_context.stop (); });
+
+  wheel.start ();
+  auto executor = io_context.get_executor ();
+  for (int i = 0; i < num_ports; i++)
+    servers.emplace (servers.end (), executor, first_port + i, wheel,
+		     options)
+	->start ();
+
+  for (unsigned int i = 0; i < num_threads; i++)
+    threads.emplace_back ([&io_context] () { run_context (io_context); });
+
+  run_context (io_context);
+  for (auto &thrd : threads)
+    thrd.join ();
+}
+
+// One io_context, thread and set of acceptors per CPU. A connection stays
+// on the thread whose acceptor took it, so nothing is shared between
+// threads on the hot path.
+static void
+run_per_core (unsigned int num_threads, const session_options &options)
+{
+  std::vector<int> cpus = allowed_cpus ();
+  if (cpus.empty ())
+    cpus.push_back (-1);
+  if (!num_threads)
+    num_threads = cpus.size ();
+
+  std::vector<std::unique_ptr<asio::io_context>> contexts;
+  std::vector<std::unique_ptr<idle_wheel>> wheels;
+  std::list<server> servers;
+  for (unsigned int i = 0; i < num_threads; i++)
+    {
+      contexts.emplace_back (new asio::io_context (1));
+      auto executor = contexts.back ()->get_executor ();
+      wheels.emplace_back (new idle_wheel (executor, default_timeout));
+      wheels.back ()->start ();
+      for (int p = 0; p < num_ports; p++)
+	servers.emplace (servers.end (), executor, first_port + p,
+			 *wheels.back (), options, true)
+	    ->start ();
+    }
+
+  asio::signal_set signals (*contexts.front (), SIGINT, SIGTERM);
+  signals.async_wait (
+      [&contexts] (const sys::error_code & /*error*/, int /*signum*/)
+	{
+	  for (auto &ctx : contexts)
+	    ctx->stop ();
+	});
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < num_threads; i++)
+    {
+      int cpu = cpus[i % cpus.size ()];
+      asio::io_context &ctx = *contexts[i];
+      threads.emplace_back (
+	  [&ctx, cpu] ()
+	    {
+	      if (cpu >= 0)
+		pin_this_thread (cpu);
+	      run_context (ctx);
+	    });
+    }
+
+  for (auto &thrd : threads)
+    thrd.join ();
+}
+
+static void
+usage (const char *prog)
+{
+  std::printf ("Usage: %s [--per-core] [--threads N] [--pipeline] "
+	       "[--splice]\n"
+	       "  --per-core  one pinned io_context and SO_REUSEPORT\n"
+	       "              acceptor per CPU instead of one shared\n"
+	       "              io_context\n"
+	       "  --threads   number of threads (default: 2 x CPUs shared,\n"
+	       "              one per allowed CPU per-core)\n"
+	       "  --pipeline  keep reading while echoes are being written\n"
+	       "              and coalesce them into fewer writes\n"
+	       "  --splice    echo through a pipe with splice (2), without\n"
+	       "              copying to user space; overrides --pipeline\n",
+	       prog);
+}
+
+int
+main (int argc, char **argv)
+{
+  bool per_core = false;
+  unsigned int num_threads = 0;
+  session_options options;
+
+  for (int i = 1; i < argc; i++)
+    {
+      if (!std::strcmp (argv[i], "--per-core"))
+	per_core = true;
+      else if (!std::strcmp (argv[i], "--threads") && i + 1 < argc)
+	num_threads = std::strtoul (argv[++i], nullptr, 10);
+      else if (!std::strcmp (argv[i], "--pipeline"))
+	options.max_pending = pipeline_limit;
+      else if (!std::strcmp (argv[i], "--splice"))
+	options.zero_copy = true;
+      else
+	{
+	  usage (argv[0]);
+	  return 1;
+	}
+    }
+
+  try
+    {
+      if (per_core)
+	run_per_core (num_threads, options);
+      else
+	{
+	  if (!num_threads)
+	    {
+	      num_threads = std::thread::hardware_concurrency ();
+	      num_threads = num_threads ? num_threads * 2 : 10;
+	    }
+	  run_shared (num_threads, options);
+	}
     }
   catch (const std::exception &e)
     {
@@ -0,0 +1,182 @@
+#include <list>
+
+#include <boost/asio.hpp>
+
+#include "work_stealing_pool.h"
+
+namespace sys = boost::system;
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+constexpr size_t buffer_size = 1024;
+
+// Stand-in for compression or parsing: something that should not run on
+// an IO thread.
+void
+transform (char *data, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+    data[i] = static_cast<char> (data[i] ^ 0x20);
+}
+
+// Echo server that sends every request through the work-stealing pool and
+// picks the result up again on the session's strand.
+class session : public std::enable_shared_from_this<session>
+{
+public:
+  using pointer = std::shared_ptr<session>;
+
+  static pointer
+  make (tcp::socket sock, work_stealing_pool::executor_type pool)
+  {
+    return std::make_shared<session> (std::move (sock), std::move (pool));
+  }
+
+  session (tcp::socket sock, work_stealing_pool::executor_type pool)
+      : socket_ (std::move (sock)), pool_ (std::move (pool))
+  {
+  }
+
+  void
+  start ()
+  {
+    receive ();
+  }
+
+private:
+  void
+  receive ()
+  {
+    auto self = shared_from_this ();
+    auto handle_receive = [self] (const sys::error_code &error, size_t bytes)
+      {
+	if (error)
+	  {
+	    self->socket_.close ();
+	    return;
+	  }
+	self->process (bytes);
+      };
+
+    socket_.async_receive (asio::buffer (buffer_),
+			   asio::bind_executor (strand_, handle_receive));
+  }
+
+  void
+  process (size_t bytes)
+  {
+    auto self = shared_from_this ();
+    auto work = [self, bytes] ()
+      {
+	transform (self->buffer_.data (), bytes);
+	asio::post (self->strand_, [self, bytes] () { self->send (bytes); });
+      };
+
+    asio::post (pool_, work);
+  }
+
+  void
+  send (size_t bytes_to_send)
+  {
+    auto self = shared_from_this ();
+    auto handle_write = [self] (const sys::error_code &error, size_t /*bytes*/)
+      {
+	if (error)
+	  {
+	    self->socket_.close ();
+	    return;
+	  }
+	self->receive ();
+      };
+
+    asio::async_write (socket_, asio::buffer (buffer_, bytes_to_send),
+		       asio::bind_executor (strand_, handle_write));
+  }
+
+private:
+  tcp::socket socket_;
+  asio::strand<asio::any_io_executor> strand_{ socket_.get_executor () };
+  work_stealing_pool::executor_type pool_;
+
+  std::array<char, buffer_size> buffer_;
+};
+
+class server
+{
+public:
+  server (asio::any_io_executor ex, short port,
+	  work_stealing_pool::executor_type pool)
+      : acceptor_ (ex, tcp::endpoint (tcp::v4 (), port)),
+	pool_ (std::move (pool))
+  {
+  }
+
+  void
+  start ()
+  {
+    auto handle_accept
+	= [this] (const sys::error_code &error, tcp::socket sock)
+      {
+	if (error)
+	  return;
+
+	session::make (std::move (sock), pool_)->start ();
+
+	start ();
+      };
+
+    acceptor_.async_accept (handle_accept);
+  }
+
+private:
+  tcp::acceptor acceptor_;
+  work_stealing_pool::executor_type pool_;
+};
+
+int
+main ()
+{
+  try
+    {
+      unsigned int num_threads = std::thread::hardware_concurrency ();
+      num_threads = num_threads ? num_threads : 4;
+
+      asio::io_context io_context;
+      work_stealing_pool pool (num_threads);
+      asio::signal_set signals (io_context, SIGINT, SIGTERM);
+      std::list<server> servers;
+      std::vector<std::thread> threads;
+
+      signals.async_wait ([&] (const sys::error_code & /*error*/,
+			       int /*signum*/) { io_context.stop (); });
+
+      auto executor = io_context.get_executor ();
+      for (int i = 0; i < 10; i++)
+	servers.emplace (servers.end (), executor, 8080 + i,
+			 pool.get_executor ())
+	    ->start ();
+
+      for (unsigned int i = 1; i < num_threads; i++)
+	threads.emplace_back (
+	    [&io_context] ()
+	      {
+		try
+		  {
+		    io_context.run ();
+		  }
+		catch (const std::exception &e)
+		  {
+		    std::printf ("exception: %s\n", e.what ());
+		  }
+	      });
+
+      io_context.run ();
+      for (auto &thrd : threads)
+	thrd.join ();
+      pool.stop ();
+    }
+  catch (const std::exception &e)
+    {
+      std::printf ("exception: %s\n", e.what ());
+    }
+}
@@ -0,0 +1,465 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "chase_lev_deque.h"
+#include "concurrent_lock_free_queue.h"
+
+namespace asio = boost::asio;
+
+// Fixed set of threads for CPU-bound handlers. Every worker owns a
+// Chase-Lev deque: handlers submitted from a worker go to its own deque and
+// run newest first, handlers submitted from outside go through a shared
+// injection queue, and a worker with nothing to do steals the oldest
+// handler from a random peer before it parks. Parked workers are only woken
+// when there is somebody to wake.
+//
+// The pool is an asio execution context and its executor satisfies the
+// standard executor requirements, so handlers can be posted, dispatched or
+// bound to it like to an io_context. Handlers must not throw.
+class work_stealing_pool : public asio::execution_context
+{
+  struct task
+  {
+    virtual ~task () = default;
+    virtual void run () = 0;
+  };
+
+  template <typename F>
+  struct task_impl final : task
+  {
+    explicit task_impl (F &&f) : f (std::move (f)) {}
+    explicit task_impl (const F &f) : f (f) {}
+
+    void
+    run () override
+    {
+      f ();
+    }
+
+    F f;
+  };
+
+  struct alignas (64) worker
+  {
+    worker (work_stealing_pool &pool, unsigned index)
+	: pool (pool), seed (index * 2654435761u + 1)
+    {
+    }
+
+    work_stealing_pool &pool;
+    chase_lev_deque<task *> deque;
+    unsigned seed;
+    std::thread thread;
+  };
+
+  enum : unsigned
+  {
+    blocking_never = 1,
+    outstanding_work_tracked = 2,
+  };
+
+public:
+  using size_type = size_t;
+
+  template <unsigned Bits>
+  class basic_executor_type
+  {
+  public:
+    basic_executor_type (const basic_executor_type &other) noexcept
+	: pool_ (other.pool_)
+    {
+      if ((Bits & outstanding_work_tracked) && pool_)
+	pool_->work_started ();
+    }
+
+    basic_executor_type (basic_executor_type &&other) noexcept
+	: pool_ (other.pool_)
+    {
+      if (Bits & outstanding_work_tracked)
+	other.pool_ = nullptr;
+    }
+
+    ~basic_executor_type ()
+    {
+      if ((Bits & outstanding_work_tracked) && pool_)
+	pool_->work_finished ();
+    }
+
+    basic_executor_type &
+    operator= (const basic_executor_type &other) noexcept
+    {
+      basic_executor_type tmp (other);
+      std::swap (pool_, tmp.pool_);
+      return *this;
+    }
+
+    basic_executor_type &
+    operator= (basic_executor_type &&other) noexcept
+    {
+      std::swap (pool_, other.pool_);
+      return *this;
+    }
+
+    work_stealing_pool &
+    query (asio::execution::context_t) const noexcept
+    {
+      return *pool_;
+    }
+
+    static constexpr asio::execution::mapping_t
+    query (asio::execution::mapping_t) noexcept
+    {
+      return asio::execution::mapping.thread;
+    }
+
+    static constexpr asio::execution::blocking_t
+    query (asio::execution::blocking_t) noexcept
+    {
+      return (Bits & blocking_never)
+		 ? asio::execution::blocking_t (
+		     asio::execution::blocking.never)
+		 : asio::execution::blocking_t (
+		     asio::execution::blocking.possibly);
+    }
+
+    static constexpr asio::execution::outstanding_work_t
+    query (asio::execution::outstanding_work_t) noexcept
+    {
+      return (Bits & outstanding_work_tracked)
+		 ? asio::execution::outstanding_work_t (
+		     asio::execution::outstanding_work.tracked)
+		 : asio::execution::outstanding_work_t (
+		     asio::execution::outstanding_work.untracked);
+    }
+
+    static constexpr asio::execution::relationship_t
+    query (asio::execution::relationship_t) noexcept
+    {
+      return asio::execution::relationship.fork;
+    }
+
+    basic_executor_type<Bits | blocking_never>
+    require (asio::execution::blocking_t::never_t) const
+    {
+      return basic_executor_type<Bits | blocking_never> (pool_);
+    }
+
+    basic_executor_type<Bits & ~blocking_never>
+    require (asio::execution::blocking_t::possibly_t) const
+    {
+      return basic_executor_type<Bits & ~blocking_never> (pool_);
+    }
+
+    basic_executor_type<Bits | outstanding_work_tracked>
+    require (asio::execution::outstanding_work_t::tracked_t) const
+    {
+      return basic_executor_type<Bits | outstanding_work_tracked> (pool_);
+    }
+
+    basic_executor_type<Bits & ~outstanding_work_tracked>
+    require (asio::execution::outstanding_work_t::untracked_t) const
+    {
+      return basic_executor_type<Bits & ~outstanding_work_tracked> (pool_);
+    }
+
+    // Every handler may run on any worker; the hint changes nothing.
+    basic_executor_type
+    require (asio::execution::relationship_t::fork_t) const
+    {
+      return *this;
+    }
+
+    basic_executor_type
+    require (asio::execution::relationship_t::continuation_t) const
+    {
+      return *this;
+    }
+
+    bool
+    running_in_this_thread () const noexcept
+    {
+      return pool_->running_in_this_thread ();
+    }
+
+    template <typename F>
+    void
+    execute (F &&f) const
+    {
+      using function = typename std::decay<F>::type;
+
+      if (!(Bits & blocking_never) && pool_->running_in_this_thread ())
+	{
+	  function tmp (std::forward<F> (f));
+	  tmp ();
+	  return;
+	}
+
+      pool_->submit (new task_impl<function> (std::forward<F> (f)));
+    }
+
+    friend bool
+    operator== (const basic_executor_type &a,
+		const basic_executor_type &b) noexcept
+    {
+      return a.pool_ == b.pool_;
+    }
+
+    friend bool
+    operator!= (const basic_executor_type &a,
+		const basic_executor_type &b) noexcept
+    {
+      return a.pool_ != b.pool_;
+    }
+
+  private:
+    friend class work_stealing_pool;
+    template <unsigned> friend class basic_executor_type;
+
+    explicit basic_executor_type (work_stealing_pool *pool) noexcept
+	: pool_ (pool)
+    {
+      if ((Bits & outstanding_work_tracked) && pool_)
+	pool_->work_started ();
+    }
+
+    work_stealing_pool *pool_;
+  };
+
+  using executor_type = basic_executor_type<0>;
+
+  explicit work_stealing_pool (unsigned num_threads = default_threads ())
+      : outstanding_ (0), joining_ (false), stopped_ (false), sleepers_ (0),
+	epoch_ (0)
+  {
+    if (num_threads == 0)
+      num_threads = 1;
+
+    workers_.reserve (num_threads);
+    for (unsigned i = 0; i < num_threads; i++)
+      workers_.emplace_back (new worker (*this, i));
+
+    // Start only once the vector is complete, since thieves walk it.
+    for (auto &w : workers_)
+      w->thread = std::thread ([this, &w] () { run (*w); });
+  }
+
+  // As in asio::thread_pool: services are shut down once no worker can
+  // touch them any more, and destroyed after the handlers left queued, which
+  // may still own objects of theirs; both before the members go away.
+  ~work_stealing_pool ()
+  {
+    stop ();
+    join ();
+    shutdown ();
+
+    for (auto &w : workers_)
+      while (auto t = w->deque.pop ())
+	delete *t;
+    while (auto t = injected_.try_pop ())
+      delete *t;
+
+    destroy ();
+  }
+
+  work_stealing_pool (const work_stealing_pool &) = delete;
+  work_stealing_pool &operator= (const work_stealing_pool &) = delete;
+
+  executor_type
+  get_executor () noexcept
+  {
+    return executor_type (this);
+  }
+
+  // Waits for all submitted handlers, including those they submit in turn,
+  // and for all tracked executors to go away, then stops the workers. Must
+  // not be called from a worker.
+  void
+  join ()
+  {
+    joining_.store (true);
+    wake_all ();
+
+    for (auto &w : workers_)
+      if (w->thread.joinable ())
+	w->thread.join ();
+  }
+
+  // Makes the workers exit after their current handler; whatever is still
+  // queued is destroyed without being run.
+  void
+  stop ()
+  {
+    stopped_.store (true);
+    wake_all ();
+  }
+
+  bool
+  running_in_this_thread () const noexcept
+  {
+    return current_ && &current_->pool == this;
+  }
+
+private:
+  static unsigned
+  default_threads ()
+  {
+    return std::thread::hardware_concurrency ();
+  }
+
+  void
+  submit (task *t)
+  {
+    outstanding_.fetch_add (1, std::memory_order_relaxed);
+
+    if (running_in_this_thread ())
+      current_->deque.push (t);
+    else
+      injected_.push (t);
+
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (sleepers_.load (std::memory_order_relaxed) > 0)
+      wake_one ();
+  }
+
+  void
+  work_started () noexcept
+  {
+    outstanding_.fetch_add (1, std::memory_order_relaxed);
+  }
+
+  void
+  work_finished () noexcept
+  {
+    if (outstanding_.fetch_sub (1) == 1 && joining_.load ())
+      wake_all ();
+  }
+
+  void
+  run (worker &self)
+  {
+    current_ = &self;
+    while (!stopped_.load (std::memory_order_relaxed))
+      {
+	if (task *t = find_task (self))
+	  {
+	    t->run ();
+	    delete t;
+	    work_finished ();
+	  }
+	else if (!park ())
+	  break;
+      }
+    current_ = nullptr;
+  }
+
+  task *
+  find_task (worker &self)
+  {
+    if (auto t = self.deque.pop ())
+      return *t;
+    if (auto t = injected_.try_pop ())
+      return *t;
+
+    size_type n = workers_.size ();
+    self.seed ^= self.seed << 13;
+    self.seed ^= self.seed >> 17;
+    self.seed ^= self.seed << 5;
+
+    for (size_type i = 0, first = self.seed % n; i < n; i++)
+      {
+	worker &victim = *workers_[(first + i) % n];
+	if (&victim == &self)
+	  continue;
+	if (auto t = victim.deque.steal ())
+	  return *t;
+      }
+
+    return nullptr;
+  }
+
+  bool
+  has_work () const
+  {
+    if (!injected_.empty ())
+      return true;
+    for (auto &w : workers_)
+      if (!w->deque.empty ())
+	return true;
+    return false;
+  }
+
+  bool
+  done () const
+  {
+    return stopped_.load () || (joining_.load () && outstanding_.load () == 0);
+  }
+
+  // Returns false once the worker should exit. The sleeper count and the
+  // submitter's queue write are ordered by fences on both sides, so either
+  // the submitter sees the sleeper or the sleeper sees the work.
+  bool
+  park ()
+  {
+    std::unique_lock<std::mutex> lock (mutex_);
+    sleepers_.fetch_add (1);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+
+    if (!done () && !has_work ())
+      {
+	size_type epoch = epoch_;
+	auto woken = [this, epoch] () { return epoch_ != epoch || done (); };
+	cv_.wait (lock, woken);
+      }
+
+    sleepers_.fetch_sub (1);
+    return !done ();
+  }
+
+  void
+  wake_one ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      epoch_++;
+    }
+    cv_.notify_one ();
+  }
+
+  void
+  wake_all ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      epoch_++;
+    }
+    cv_.notify_all ();
+  }
+
+private:
+  static inline thread_local worker *current_ = nullptr;
+
+  std::vector<std::unique_ptr<worker>> workers_;
+  concurrent_lock_free_queue<task *> injected_;
+
+  alignas (64) std::atomic<size_type> outstanding_;
+  std::atomic<bool> joining_;
+  std::atomic<bool> stopped_;
+
+  alignas (64) std::atomic<size_type> sleepers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_type epoch_;
+};
+
+#endif // WORK_STEALING_POOL_H
@@ -1,5 +1,11 @@
+#include <cstring>
+
 #include <boost/asio.hpp>
 
+#include "handler_memory.h"
+#include "object_pool.h"
+#include "splice_pipe.h"
+
 namespace sys = boost::system;
 namespace asio = boost::asio;
 using asio::ip::tcp;
@@ -7,6 +13,10 @@ using asio::ip::tcp;
 constexpr asio::chrono::seconds default_timeout (5);
 constexpr size_t buffer_size = 1024;
 
+// Every idle pipe holds two descriptors that accept () could use, so
+// keep only a few: at most four per thread and eight more shared.
+using pipe_pool = object_pool<splice_pipe, 8, 2>;
+
 class watchdog
 {
 public:
@@ -30,7 +40,7 @@ public:
       };
 
     timer_.expires_at (deadline_);
-    timer_.async_wait (handle_wait);
+    timer_.async_wait (bind_handler_memory (memory_, handle_wait));
   }
 
   void
@@ -48,6 +58,7 @@ public:
 private:
   asio::steady_timer timer_;
   asio::steady_timer::time_point deadline_;
+  handler_memory<> memory_;
 };
 
 class session : public std::enable_shared_from_this<session>
@@ -55,18 +66,30 @@ class session : public std::enable_shared_from_this<session>
 public:
   using pointer = std::shared_ptr<session>;
 
+  // With zero_copy set, each direction relays through a pipe with
+  // splice (2) rather than through a buffer, falling back to the buffer
+  // where splice is not supported.
   static pointer
-  make (tcp::socket client,
+  make (tcp::socket client, bool zero_copy = false,
 	asio::chrono::steady_clock::duration timeout = default_timeout)
   {
-    return std::make_shared<session> (std::move (client), timeout);
+    return std::make_shared<session> (std::move (client), zero_copy,
+				      timeout);
   }
 
-  explicit session (tcp::socket client,
+  explicit session (tcp::socket client, bool zero_copy = false,
 		    asio::chrono::steady_clock::duration timeout
 		    = default_timeout)
-      : client_ (std::move (client)), timeout_ (timeout)
+      : client_ (std::move (client)), timeout_ (timeout),
+	zero_copy_ (zero_copy)
+  {
+  }
+
+  ~session ()
   {
+    for (relay *r : { &relay1_, &relay2_ })
+      if (r->pipe && r->pipe->size ())
+	r->pipe->reset ();
   }
 
   void
@@ -77,15 +100,53 @@ public:
       {
 	if (error)
 	  return;
-	self->receive_from_client ();
-	self->receive_from_server ();
+	if (self->zero_copy_ && self->make_non_blocking ())
+	  {
+	    self->splice_wait_readable (self->relay1_);
+	    self->splice_wait_readable (self->relay2_);
+	  }
+	else
+	  {
+	    self->receive_from_client ();
+	    self->receive_from_server ();
+	  }
 	self->start_watchdogs ();
       };
 
-    server_.async_connect (target, handle_connect);
+    server_.async_connect (target,
+			   bind_handler_memory (memory1_, handle_connect));
   }
 
 private:
+  // One direction of the zero-copy relay. The pipe is held only while
+  // data is in flight; resume_splice is set while a single buffer is
+  // copied for want of one.
+  struct relay
+  {
+    tcp::socket &from;
+    tcp::socket &to;
+    asio::strand<asio::any_io_executor> &strand;
+    handler_memory<> &memory;
+    watchdog &dog;
+    void (session::*copy) ();
+    pipe_pool::pointer pipe;
+    bool resume_splice;
+  };
+
+  // Each direction is a chain with one operation in flight at a time, so
+  // it recycles a single handler block; the connect runs before either
+  // chain starts and borrows the first.
+  template <typename Handler>
+  static auto
+  bind_handler (handler_memory<> &memory,
+		const asio::strand<asio::any_io_executor> &strand,
+		Handler handler)
+      -> decltype (bind_handler_memory (memory,
+					asio::bind_executor (strand, handler)))
+  {
+    return bind_handler_memory (memory, asio::bind_executor (strand, handler));
+  }
+
   void
   stop ()
   {
@@ -110,7 +171,7 @@ private:
       };
 
     client_.async_receive (asio::buffer (client_buffer_),
-			   asio::bind_executor (strand1_, handle_receive));
+			   bind_handler (memory1_, strand1_, handle_receive));
     watchdog1_.delay (timeout_);
   }
 
@@ -125,11 +186,11 @@ private:
 	    self->stop ();
 	    return;
 	  }
-	self->receive_from_client ();
+	self->receive_next (self->relay1_);
       };
 
     asio::async_write (server_, asio::buffer (client_buffer_, bytes_to_send),
-		       asio::bind_executor (strand1_, handle_write));
+		       bind_handler (memory1_, strand1_, handle_write));
     watchdog1_.delay (timeout_);
   }
 
@@ -148,7 +209,7 @@ private:
       };
 
     server_.async_receive (asio::buffer (server_buffer_),
-			   asio::bind_executor (strand2_, handle_receive));
+			   bind_handler (memory2_, strand2_, handle_receive));
     watchdog2_.delay (timeout_);
   }
 
@@ -163,14 +224,130 @@ private:
 	    self->stop ();
 	    return;
 	  }
-	self->receive_from_server ();
+	self->receive_next (self->relay2_);
       };
 
     asio::async_write (client_, asio::buffer (server_buffer_, bytes_to_send),
-		       asio::bind_executor (strand2_, handle_write));
+		       bind_handler (memory2_, strand2_, handle_write));
     watchdog2_.delay (timeout_);
   }
 
+  // After a copied buffer, goes back to splicing if the copy only stood in
+  // for a pipe, and copies on otherwise.
+  void
+  receive_next (relay &r)
+  {
+    if (r.resume_splice)
+      {
+	r.resume_splice = false;
+	splice_wait_readable (r);
+      }
+    else
+      (this->*r.copy) ();
+  }
+
+  bool
+  make_non_blocking ()
+  {
+    sys::error_code error;
+    client_.non_blocking (true, error);
+    if (!error)
+      server_.non_blocking (true, error);
+    return !error;
+  }
+
+  void
+  splice_wait_readable (relay &r)
+  {
+    auto self = shared_from_this ();
+    auto handle_wait = [self, &r] (const sys::error_code &error)
+      {
+	if (error)
+	  {
+	    self->stop ();
+	    return;
+	  }
+	self->splice_receive (r);
+      };
+
+    r.from.async_wait (tcp::socket::wait_read,
+		       bind_handler (r.memory, r.strand, handle_wait));
+    r.dog.delay (timeout_);
+  }
+
+  void
+  splice_receive (relay &r)
+  {
+    if (!r.pipe)
+      r.pipe = pipe_pool::acquire ();
+    if (!r.pipe->ensure_open ())
+      {
+	// Out of descriptors for now: copy one buffer, then try again.
+	r.pipe.reset ();
+	r.resume_splice = true;
+	(this->*r.copy) ();
+	return;
+      }
+
+    sys::error_code error;
+    r.pipe->fill (r.from.native_handle (), error);
+    if (error == asio::error::would_block)
+      {
+	r.pipe.reset ();
+	splice_wait_readable (r);
+	return;
+      }
+    if (error == asio::error::invalid_argument)
+      {
+	// The socket cannot be spliced; nothing has been moved.
+	r.pipe.reset ();
+	(this->*r.copy) ();
+	return;
+      }
+    if (error)
+      {
+	stop ();
+	return;
+      }
+
+    splice_send (r);
+  }
+
+  void
+  splice_send (relay &r)
+  {
+    sys::error_code error;
+    while (r.pipe->size () && !error)
+      r.pipe->drain (r.to.native_handle (), error);
+
+    if (!error)
+      {
+	r.pipe.reset ();
+	splice_wait_readable (r);
+	return;
+      }
+    if (error != asio::error::would_block)
+      {
+	stop ();
+	return;
+      }
+
+    auto self = shared_from_this ();
+    auto handle_wait = [self, &r] (const sys::error_code &error)
+      {
+	if (error)
+	  {
+	    self->stop ();
+	    return;
+	  }
+	self->splice_send (r);
+      };
+
+    r.to.async_wait (tcp::socket::wait_write,
+		     bind_handler (r.memory, r.strand, handle_wait));
+    r.dog.delay (timeout_);
+  }
+
   void
   start_watchdogs ()
   {
@@ -193,18 +370,27 @@ private:
 
   std::array<char, buffer_size> client_buffer_;
   std::array<char, buffer_size> server_buffer_;
+  handler_memory<> memory1_;
+  handler_memory<> memory2_;
+
+  bool zero_copy_;
+  relay relay1_{ client_, server_, strand1_, memory1_,
+		 watchdog1_, &session::receive_from_client, {}, false };
+  relay relay2_{ server_, client_, strand2_, memory2_,
+		 watchdog2_, &session::receive_from_server, {}, false };
 };
 
 class server
 {
 public:
-  server (asio::any_io_executor ex, const tcp::endpoint &ep)
-      : acceptor_ (ex, ep)
+  server (asio::any_io_executor ex, const tcp::endpoint &ep,
+	  bool zero_copy = false)
+      : acceptor_ (ex, ep), zero_copy_ (zero_copy)
   {
   }
 
-  server (asio::any_io_executor ex, short port)
-      : server (ex, tcp::endpoint (tcp::v4 (), port))
+  server (asio::any_io_executor ex, short port, bool zero_copy = false)
+      : server (ex, tcp::endpoint (tcp::v4 (), port), zero_copy)
   {
   }
 
@@ -225,7 +411,7 @@ private:
 	if (error)
 	  return;
 
-	auto sess = session::make (std::move (sock));
+	auto sess = session::make (std::move (sock), zero_copy_);
 	sess->start (target_);
 
 	start ();
@@ -237,6 +423,7 @@ private:
 private:
   tcp::acceptor acceptor_;
   tcp::endpoint target_;
+  bool zero_copy_;
 };
 
 int
@@ -244,11 +431,15 @@ main (int argc, char **argv)
 {
   try
     {
-      if (argc != 5)
+      bool zero_copy = argc > 1 && !std::strcmp (argv[1], "--splice");
+      char **args = argv + zero_copy;
+      if (argc - zero_copy != 5)
 	{
-	  std::printf ("Usage: %s "
+	  std::printf ("Usage: %s [--splice] "
 		       "<listen_address> <listen_port> "
-		       "<target_address> <target_port>\n",
+		       "<target_address> <target_port>\n"
+		       "  --splice  relay through pipes with splice (2),\n"
+		       "            without copying to user space\n",
 		       argv[0]);
 	  return 1;
 	}
@@ -257,11 +448,11 @@ main (int argc, char **argv)
       tcp::resolver resolver (io_context);
 
       auto listen_endpoint
-	  = resolver.resolve (argv[1], argv[2]).begin ()->endpoint ();
+	  = resolver.resolve (args[1], args[2]).begin ()->endpoint ();
       auto target_endpoint
-	  = resolver.resolve (argv[3], argv[4]).begin ()->endpoint ();
+	  = resolver.resolve (args[3], args[4]).begin ()->endpoint ();
 
-      server srv (io_context.get_executor (), listen_endpoint);
+      server srv (io_context.get_executor (), listen_endpoint, zero_copy);
       srv.start (target_endpoint);
       io_context.run ();
     }
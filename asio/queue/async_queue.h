@@ -0,0 +1,376 @@
+#ifndef ASYNC_QUEUE_H
+#define ASYNC_QUEUE_H
+
+#include <atomic>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include <boost/asio.hpp>
+
+#include "concurrent_blocking_queue.h"
+
+namespace sys = boost::system;
+namespace asio = boost::asio;
+
+// concurrent_blocking_queue with an asio front-end. Threads use the queue's
+// own blocking and non-waiting operations through this wrapper; asynchronous
+// callers use async_push and async_pop with any completion token. A pending
+// asynchronous operation is stored as its completion handler rather than as
+// a parked thread, and always completes on the handler's associated
+// executor (falling back to the queue's executor), never inline.
+//
+// async_pop completes with (error_code, optional<T>); once the queue is
+// closed and drained the error is asio::error::eof and the optional empty.
+// async_push completes with (error_code); the error is
+// asio::error::operation_aborted if the queue is closed before the element
+// could be accepted.
+template <typename T>
+class async_queue
+{
+public:
+  using element_type = T;
+  using size_type = size_t;
+  using executor_type = asio::any_io_executor;
+
+  explicit async_queue (executor_type ex,
+			size_type capacity
+			= std::numeric_limits<size_type>::max ())
+      : executor_ (std::move (ex)), queue_ (capacity), pending_ (0)
+  {
+  }
+
+  async_queue (const async_queue &) = delete;
+  async_queue &operator= (const async_queue &) = delete;
+
+  ~async_queue () { close (); }
+
+  executor_type
+  get_executor () const noexcept
+  {
+    return executor_;
+  }
+
+  template <typename CompletionToken>
+  auto
+  async_pop (CompletionToken &&token)
+  {
+    auto initiation = [this] (auto handler)
+      { start_pop (std::move (handler)); };
+
+    return asio::async_initiate<CompletionToken,
+				void (sys::error_code, std::optional<T>)> (
+	initiation, token);
+  }
+
+  template <typename U, typename CompletionToken>
+  auto
+  async_push (U &&elem, CompletionToken &&token)
+  {
+    auto initiation = [this] (auto handler, T elem)
+      { start_push (std::move (handler), std::move (elem)); };
+
+    return asio::async_initiate<CompletionToken, void (sys::error_code)> (
+	initiation, token, T (std::forward<U> (elem)));
+  }
+
+  // The blocking and non-waiting operations are those of
+  // concurrent_blocking_queue; each also completes whatever asynchronous
+  // operations it made possible.
+
+  template <typename U>
+  bool
+  push (U &&elem)
+  {
+    return served (queue_.push (std::forward<U> (elem)));
+  }
+
+  template <typename U>
+  bool
+  try_push (U &&elem)
+  {
+    return served (queue_.try_push (std::forward<U> (elem)));
+  }
+
+  template <typename U, typename Duration>
+  bool
+  try_push (U &&elem, const Duration &timeout)
+  {
+    return served (queue_.try_push (std::forward<U> (elem), timeout));
+  }
+
+  template <typename InputIt>
+  size_type
+  push_range (InputIt first, InputIt last)
+  {
+    return served (queue_.push_range (first, last));
+  }
+
+  std::optional<T>
+  pop ()
+  {
+    return served (queue_.pop ());
+  }
+
+  std::optional<T>
+  try_pop ()
+  {
+    return served (queue_.try_pop ());
+  }
+
+  template <typename Duration>
+  std::optional<T>
+  try_pop (const Duration &timeout)
+  {
+    return served (queue_.try_pop (timeout));
+  }
+
+  template <typename OutputIt>
+  size_type
+  pop_up_to (size_type n, OutputIt out)
+  {
+    return served (queue_.pop_up_to (n, out));
+  }
+
+  template <typename OutputIt, typename Duration>
+  size_type
+  try_pop_up_to (size_type n, OutputIt out, const Duration &timeout)
+  {
+    return served (queue_.try_pop_up_to (n, out, timeout));
+  }
+
+  template <typename OutputIt>
+  size_type
+  pop_all (OutputIt out)
+  {
+    return served (queue_.pop_all (out));
+  }
+
+  // Pending pops complete with eof once what is left has been handed out;
+  // pending pushes were never accepted and are aborted.
+  void
+  close ()
+  {
+    queue_.close ();
+
+    std::lock_guard<std::mutex> lock (mutex_);
+    serve ();
+  }
+
+  void
+  attach (queue_notifier &n)
+  {
+    queue_.attach (n);
+  }
+
+  void
+  detach (queue_notifier &n)
+  {
+    queue_.detach (n);
+  }
+
+  size_type
+  size () const
+  {
+    return queue_.size ();
+  }
+
+  bool
+  empty () const
+  {
+    return queue_.empty ();
+  }
+
+  bool
+  is_closed () const
+  {
+    return queue_.is_closed ();
+  }
+
+private:
+  struct pop_op
+  {
+    virtual ~pop_op () = default;
+    virtual void complete (sys::error_code ec, std::optional<T> elem) = 0;
+  };
+
+  struct push_op
+  {
+    explicit push_op (T elem) : elem (std::move (elem)) {}
+    virtual ~push_op () = default;
+    virtual void complete (sys::error_code ec) = 0;
+
+    T elem;
+  };
+
+  // Keeps the handler's executor busy while the operation is pending, so
+  // io_context::run () does not return under a waiting coroutine.
+  template <typename Handler>
+  using work_executor = typename std::decay<decltype (asio::prefer (
+      std::declval<asio::associated_executor_t<Handler, executor_type>> (),
+      asio::execution::outstanding_work.tracked))>::type;
+
+  template <typename Handler>
+  static work_executor<Handler>
+  make_work (const Handler &handler, const executor_type &fallback)
+  {
+    return asio::prefer (asio::get_associated_executor (handler, fallback),
+			 asio::execution::outstanding_work.tracked);
+  }
+
+  template <typename Handler>
+  class pop_op_impl final : public pop_op
+  {
+  public:
+    pop_op_impl (Handler handler, const executor_type &fallback)
+	: work_ (make_work (handler, fallback)), handler_ (std::move (handler))
+    {
+    }
+
+    void
+    complete (sys::error_code ec, std::optional<T> elem) override
+    {
+      auto fn = [handler = std::move (handler_), ec,
+		 elem = std::move (elem)] () mutable
+	{ handler (ec, std::move (elem)); };
+      asio::post (work_, std::move (fn));
+    }
+
+  private:
+    work_executor<Handler> work_;
+    Handler handler_;
+  };
+
+  template <typename Handler>
+  class push_op_impl final : public push_op
+  {
+  public:
+    push_op_impl (Handler handler, T elem, const executor_type &fallback)
+	: push_op (std::move (elem)), work_ (make_work (handler, fallback)),
+	  handler_ (std::move (handler))
+    {
+    }
+
+    void
+    complete (sys::error_code ec) override
+    {
+      auto fn = [handler = std::move (handler_), ec] () mutable
+	{ handler (ec); };
+      asio::post (work_, std::move (fn));
+    }
+
+  private:
+    work_executor<Handler> work_;
+    Handler handler_;
+  };
+
+  // An operation is queued first and then tried, under mutex_. A blocking
+  // push or pop that lands before the try is seen by it; one that lands
+  // after takes the queue's lock after the try did, so it sees pending_ set
+  // and serves the operation itself.
+  template <typename Handler>
+  void
+  start_pop (Handler handler)
+  {
+    std::unique_ptr<pop_op> op (
+	new pop_op_impl<Handler> (std::move (handler), executor_));
+
+    std::lock_guard<std::mutex> lock (mutex_);
+    pop_ops_.push_back (std::move (op));
+    serve ();
+  }
+
+  template <typename Handler>
+  void
+  start_push (Handler handler, T elem)
+  {
+    std::unique_ptr<push_op> op (new push_op_impl<Handler> (
+	std::move (handler), std::move (elem), executor_));
+
+    std::lock_guard<std::mutex> lock (mutex_);
+    push_ops_.push_back (std::move (op));
+    serve ();
+  }
+
+  // Called after a blocking or non-waiting operation on the queue; result
+  // converts to true if it moved anything.
+  template <typename Result>
+  Result
+  served (Result result)
+  {
+    if (result && pending_.load (std::memory_order_relaxed))
+      {
+	std::lock_guard<std::mutex> lock (mutex_);
+	serve ();
+      }
+    return result;
+  }
+
+  // Called with mutex_ held. Moves pending pushes into the queue and
+  // pending pops' elements out of it, in order, until neither side can go
+  // on; each step may make room or an element for the other.
+  void
+  serve ()
+  {
+    pending_.store (pop_ops_.size () + push_ops_.size (),
+		    std::memory_order_relaxed);
+
+    for (bool progress = true; progress;)
+      {
+	progress = false;
+
+	// Read before the queue is tried: a closed queue found empty stays
+	// empty.
+	bool closed = queue_.is_closed ();
+
+	while (!push_ops_.empty ()
+	       && queue_.try_push (std::move (push_ops_.front ()->elem)))
+	  {
+	    push_ops_.front ()->complete (sys::error_code ());
+	    push_ops_.pop_front ();
+	    progress = true;
+	  }
+
+	while (!pop_ops_.empty ())
+	  {
+	    std::optional<T> elem = queue_.try_pop ();
+	    if (!elem)
+	      break;
+
+	    pop_ops_.front ()->complete (sys::error_code (), std::move (elem));
+	    pop_ops_.pop_front ();
+	    progress = true;
+	  }
+
+	if (closed && !progress)
+	  {
+	    for (auto &op : push_ops_)
+	      op->complete (asio::error::operation_aborted);
+	    for (auto &op : pop_ops_)
+	      op->complete (asio::error::eof, std::nullopt);
+	    push_ops_.clear ();
+	    pop_ops_.clear ();
+	  }
+      }
+
+    pending_.store (pop_ops_.size () + push_ops_.size (),
+		    std::memory_order_relaxed);
+  }
+
+private:
+  executor_type executor_;
+  concurrent_blocking_queue<T> queue_;
+
+  std::mutex mutex_;
+  std::deque<std::unique_ptr<pop_op>> pop_ops_;
+  std::deque<std::unique_ptr<push_op>> push_ops_;
+
+  // How many operations are pending, so that the blocking side only takes
+  // mutex_ when there is something to serve.
+  std::atomic<size_type> pending_;
+};
+
+#endif // ASYNC_QUEUE_H
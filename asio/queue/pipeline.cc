@@ -0,0 +1,202 @@
+#include <cctype>
+#include <list>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/context/fixedsize_stack.hpp>
+
+#include "async_queue.h"
+
+namespace sys = boost::system;
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+constexpr size_t max_receive = 1024;
+constexpr size_t max_jobs = 1024;
+
+using allocator_t = boost::context::fixedsize_stack;
+allocator_t allocator (8 * 1024);
+
+void
+handle_spawn (std::exception_ptr e)
+{
+  if (e)
+    std::rethrow_exception (e);
+}
+
+class session;
+
+struct job
+{
+  std::string data;
+  std::shared_ptr<session> owner;
+};
+
+// Echo server whose sessions hand each request to a pool of plain worker
+// threads and await the reply, without blocking an IO thread on either
+// queue.
+class session : public std::enable_shared_from_this<session>
+{
+public:
+  using pointer = std::shared_ptr<session>;
+
+  static pointer
+  make (tcp::socket sock, async_queue<job> &jobs)
+  {
+    return std::make_shared<session> (std::move (sock), jobs);
+  }
+
+  session (tcp::socket sock, async_queue<job> &jobs)
+      : socket_ (std::move (sock)), jobs_ (jobs)
+  {
+  }
+
+  void
+  start ()
+  {
+    auto self = shared_from_this ();
+    auto echo = [this, self] (asio::yield_context yield)
+      {
+	for (;;)
+	  {
+	    size_t n;
+	    sys::error_code ec;
+
+	    buffer_.resize (max_receive);
+	    n = socket_.async_receive (asio::buffer (buffer_), yield[ec]);
+	    if (ec)
+	      break;
+
+	    buffer_.resize (n);
+	    jobs_.async_push (job{ std::move (buffer_), self }, yield[ec]);
+	    if (ec)
+	      break;
+
+	    auto reply = replies_.async_pop (yield[ec]);
+	    if (ec)
+	      break;
+
+	    buffer_ = std::move (*reply);
+
+	    asio::async_write (socket_, asio::buffer (buffer_), yield[ec]);
+	    if (ec)
+	      break;
+	  }
+	socket_.close ();
+      };
+    asio::spawn (strand_, std::allocator_arg, allocator, echo, handle_spawn);
+  }
+
+  // Called from a worker thread; completes the pending async_pop on the
+  // session's strand.
+  void
+  reply (std::string data)
+  {
+    replies_.push (std::move (data));
+  }
+
+private:
+  tcp::socket socket_;
+  asio::strand<asio::any_io_executor> strand_{ socket_.get_executor () };
+  async_queue<job> &jobs_;
+  async_queue<std::string> replies_{ strand_, 1 };
+
+  std::string buffer_;
+};
+
+class server
+{
+public:
+  server (asio::io_context &io, short port, async_queue<job> &jobs)
+      : acceptor_ (io, tcp::endpoint (tcp::v4 (), port)), jobs_ (jobs)
+  {
+  }
+
+  void
+  start ()
+  {
+    auto listen = [this] (asio::yield_context yield)
+      {
+	for (;;)
+	  {
+	    auto sock = acceptor_.async_accept (yield);
+	    session::make (std::move (sock), jobs_)->start ();
+	  }
+      };
+
+    asio::spawn (acceptor_.get_executor (), std::allocator_arg, allocator,
+		 listen, handle_spawn);
+  }
+
+private:
+  tcp::acceptor acceptor_;
+  async_queue<job> &jobs_;
+};
+
+void
+work (async_queue<job> &jobs)
+{
+  while (auto j = jobs.pop ())
+    {
+      for (char &c : j->data)
+	c = std::toupper (static_cast<unsigned char> (c));
+      j->owner->reply (std::move (j->data));
+    }
+}
+
+int
+main ()
+{
+  try
+    {
+      asio::io_context io_context;
+      asio::signal_set signals (io_context, SIGINT, SIGTERM);
+      async_queue<job> jobs (io_context.get_executor (), max_jobs);
+      std::list<server> servers;
+      std::vector<std::thread> threads;
+      std::vector<std::thread> workers;
+
+      auto wait = [&signals, &io_context, &jobs] (asio::yield_context yield)
+	{
+	  signals.async_wait (yield);
+	  jobs.close ();
+	  io_context.stop ();
+	};
+
+      asio::spawn (io_context, std::allocator_arg, allocator, wait,
+		   handle_spawn);
+
+      for (int i = 0; i < 10; i++)
+	servers.emplace (servers.end (), io_context, 8080 + i, jobs)->start ();
+
+      unsigned int num_threads = std::thread::hardware_concurrency ();
+      num_threads = num_threads ? num_threads : 4;
+      for (unsigned int i = 0; i < num_threads; i++)
+	{
+	  workers.emplace_back ([&jobs] () { work (jobs); });
+	  threads.emplace_back (
+	      [&io_context] ()
+		{
+		  try
+		    {
+		      io_context.run ();
+		    }
+		  catch (const std::exception &e)
+		    {
+		      printf ("exception: %s\n", e.what ());
+		    }
+		});
+	}
+
+      io_context.run ();
+      for (auto &thrd : threads)
+	thrd.join ();
+      for (auto &thrd : workers)
+	thrd.join ();
+    }
+  catch (const std::exception &e)
+    {
+      printf ("exception: %s\n", e.what ());
+    }
+}
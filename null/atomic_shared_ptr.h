@@ -0,0 +1,254 @@
+#ifndef ATOMIC_SHARED_PTR_H
+#define ATOMIC_SHARED_PTR_H
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include "shared_ptr.h"
+
+// shared_ptr<T> that can be loaded and replaced concurrently without locks.
+//
+// Every stored value is wrapped in a snapshot block, itself a control
+// block, and the snapshot's address shares one word with a 16-bit count of
+// loads (a split reference count). The atomic pre-pays a large batch of
+// references on the snapshot when storing it, and a load claims one of
+// them by incrementing the load count in the word: a single fetch_add,
+// which never waits and never touches the snapshot. Whoever replaces the
+// snapshot hands back the references that were not claimed. A load that
+// finds the batch half used tops it up, so the count cannot overflow as
+// long as fewer than 2^15 loads race with each other.
+//
+// Pointers returned by load () share ownership with the snapshot rather
+// than with the shared_ptr that was stored; their use_count () includes
+// the unclaimed batch. Storing such a pointer again stores the original
+// instead, so snapshots do not nest.
+//
+// Snapshots must live in the low 48 bits of the address space, as heap
+// memory does on x86-64 with 4-level paging and on AArch64 without tagged
+// pointers. Under 5-level paging (LA57) or with top-byte tags (TBI, MTE)
+// an address may not fit; storing one throws std::runtime_error rather
+// than corrupting it.
+template <class T>
+class atomic_shared_ptr
+{
+  static_assert (sizeof (uintptr_t) == 8,
+		 "The load count lives in the top bits of a 64-bit word.");
+
+public:
+  typedef shared_ptr<T> value_type;
+
+  atomic_shared_ptr () noexcept : word_{ 0 } {}
+  explicit atomic_shared_ptr (shared_ptr<T> sp)
+      : word_{ wrap (std::move (sp)) }
+  {
+  }
+
+  ~atomic_shared_ptr () { settle (word_.load (std::memory_order_acquire)); }
+
+  atomic_shared_ptr (const atomic_shared_ptr &) = delete;
+  atomic_shared_ptr &operator= (const atomic_shared_ptr &) = delete;
+
+  static constexpr bool
+  is_lock_free () noexcept
+  {
+    return true;
+  }
+
+  shared_ptr<T>
+  load () const
+  {
+    uintptr_t word = word_.fetch_add (one, std::memory_order_acquire) + one;
+    if (count (word) >= refill)
+      top_up (word);
+
+    snapshot *s = unpack (word);
+    if (!s)
+      return shared_ptr<T>{};
+    return shared_ptr<T>{ s->value.get (), s };
+  }
+
+  void
+  store (shared_ptr<T> sp)
+  {
+    exchange (std::move (sp));
+  }
+
+  shared_ptr<T>
+  exchange (shared_ptr<T> sp)
+  {
+    uintptr_t word = wrap (std::move (sp));
+    return settle (word_.exchange (word, std::memory_order_acq_rel));
+  }
+
+  // Succeeds if the stored value points to the same object with the same
+  // owner as expected; otherwise loads the stored value into expected.
+  bool
+  compare_exchange_strong (shared_ptr<T> &expected, shared_ptr<T> desired)
+  {
+    uintptr_t next = 0;
+    bool wrapped = false;
+
+    for (;;)
+      {
+	// Holding a reference keeps the snapshot, and so its address, from
+	// being reused while we compare against it.
+	shared_ptr<T> current = load ();
+	if (!equivalent (current, expected))
+	  {
+	    if (wrapped)
+	      settle (next);
+	    expected = std::move (current);
+	    return false;
+	  }
+
+	if (!wrapped)
+	  {
+	    next = wrap (std::move (desired));
+	    wrapped = true;
+	  }
+
+	uintptr_t word = word_.load (std::memory_order_relaxed);
+	while (unpack (word) == current.pb_)
+	  if (word_.compare_exchange_weak (word, next,
+					   std::memory_order_acq_rel,
+					   std::memory_order_relaxed))
+	    {
+	      settle (word);
+	      return true;
+	    }
+      }
+  }
+
+  bool
+  compare_exchange_weak (shared_ptr<T> &expected, shared_ptr<T> desired)
+  {
+    return compare_exchange_strong (expected, std::move (desired));
+  }
+
+  operator shared_ptr<T> () const { return load (); }
+
+  atomic_shared_ptr &
+  operator= (shared_ptr<T> sp)
+  {
+    store (std::move (sp));
+    return *this;
+  }
+
+private:
+  typedef control_block_base<atomic_policy> block_base;
+
+  struct snapshot final : block_base
+  {
+    explicit snapshot (shared_ptr<T> value) : value{ std::move (value) } {}
+
+    void
+    dispose () override
+    {
+      value = shared_ptr<T>{};
+    }
+
+    void
+    destroy () override
+    {
+      delete this;
+    }
+
+    shared_ptr<T> value;
+  };
+
+  static constexpr unsigned shift = 48;
+  static constexpr uintptr_t one = uintptr_t{ 1 } << shift;
+  static constexpr long batch = 1L << 16;
+  static constexpr long refill = batch / 2;
+
+  static snapshot *
+  unpack (uintptr_t word) noexcept
+  {
+    return reinterpret_cast<snapshot *> (word & (one - 1));
+  }
+
+  static long
+  count (uintptr_t word) noexcept
+  {
+    return static_cast<long> (word >> shift);
+  }
+
+  static uintptr_t
+  wrap (shared_ptr<T> sp)
+  {
+    if (!sp)
+      return 0;
+
+    // A pointer that came from load () is replaced by the one stored.
+    if (auto *loaded = dynamic_cast<snapshot *> (sp.pb_))
+      if (loaded->value.px_ == sp.px_)
+	sp = loaded->value;
+
+    snapshot *s = new snapshot{ std::move (sp) };
+    uintptr_t word = reinterpret_cast<uintptr_t> (s);
+    if (word >> shift)
+      {
+	delete s;
+	throw std::runtime_error (
+	    "atomic_shared_ptr: address does not fit in 48 bits");
+      }
+
+    s->use_count.add (batch - 1);
+    return word;
+  }
+
+  // Takes over the references a word that is no longer stored still
+  // holds: one becomes the returned pointer, the unclaimed rest go back.
+  static shared_ptr<T>
+  settle (uintptr_t word)
+  {
+    snapshot *s = unpack (word);
+    if (!s)
+      return shared_ptr<T>{};
+
+    long unclaimed = batch - count (word) - 1;
+    if (unclaimed)
+      s->use_count.add (-unclaimed);
+    return shared_ptr<T>{ s->value.get (), s };
+  }
+
+  // Pays for another half batch and takes it off the load count, unless
+  // somebody else already did or the word was replaced. The caller's own
+  // claimed reference keeps the snapshot alive throughout.
+  void
+  top_up (uintptr_t word) const
+  {
+    snapshot *s = unpack (word);
+    if (s)
+      s->use_count.add (refill);
+
+    while (unpack (word) == s && count (word) >= refill)
+      if (word_.compare_exchange_weak (word, word - refill * one,
+				       std::memory_order_relaxed))
+	return;
+
+    if (s)
+      s->use_count.add (-refill);
+  }
+
+  static bool
+  equivalent (const shared_ptr<T> &a, const shared_ptr<T> &b) noexcept
+  {
+    if (a.pb_ == b.pb_)
+      return a.px_ == b.px_;
+    if (!a.pb_ || !b.pb_)
+      return false;
+
+    // a came from load (), so its block is a snapshot; b may be the
+    // shared_ptr that was stored rather than a loaded copy.
+    const shared_ptr<T> &stored = static_cast<snapshot *> (a.pb_)->value;
+    return stored.pb_ == b.pb_ && stored.px_ == b.px_;
+  }
+
+private:
+  mutable std::atomic<uintptr_t> word_;
+};
+
+#endif // ATOMIC_SHARED_PTR_H
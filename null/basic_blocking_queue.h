@@ -0,0 +1,474 @@
+#ifndef BASIC_BLOCKING_QUEUE_H
+#define BASIC_BLOCKING_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "queue_notifier.h"
+
+// Decides, with the queue's lock held, whom to wake after n elements were
+// added or removed: returns how many of the waiters on cv to notify once
+// the lock is dropped. Notifying nobody when nobody waits, and only after
+// unlocking, spares both sides a trip through the scheduler; a policy may
+// instead notify cv itself and return 0.
+struct notify_waiters
+{
+  static size_t
+  on_change (std::condition_variable &, size_t n, size_t waiters)
+  {
+    return std::min (n, waiters);
+  }
+};
+
+// The locking, waiting and wake-up logic shared by the blocking queues;
+// Container decides the order elements come out in. It needs push (U &&),
+// a pop () that removes and returns the next element, size () and
+// empty (), and is only ever touched under the queue's lock.
+template <typename T, typename Container, typename Notify = notify_waiters>
+class basic_blocking_queue
+{
+public:
+  using element_type = T;
+  using size_type = size_t;
+
+  // max_spin bounds how many pause iterations a caller may spin, watching
+  // the size, before it takes the lock and blocks; 0 never spins. The
+  // actual budget adapts to how long recent spins needed to succeed.
+  explicit basic_blocking_queue (size_type capacity
+				 = std::numeric_limits<size_type>::max (),
+				 unsigned max_spin = 0,
+				 Container queue = Container ())
+      : capacity_ (capacity), queue_ (std::move (queue)), size_ (0),
+	max_spin_ (max_spin), spin_ (0), closed_ (false),
+	not_full_waiters_ (0), not_empty_waiters_ (0)
+  {
+  }
+
+  basic_blocking_queue (const basic_blocking_queue &) = delete;
+  basic_blocking_queue &operator= (const basic_blocking_queue &) = delete;
+
+  template <typename U>
+  bool
+  push (U &&elem)
+  {
+    spin_until_not_full ();
+
+    std::unique_lock<std::mutex> lock (mutex_);
+    wait (lock, not_full_cv_, not_full_waiters_,
+	  [this] () { return queue_.size () < capacity_ || closed_; });
+
+    if (closed_)
+      return false;
+
+    queue_.push (std::forward<U> (elem));
+    size_type wake = added (1);
+
+    lock.unlock ();
+    notify (not_empty_cv_, wake);
+
+    return true;
+  }
+
+  // Never waits; returns false, leaving elem alone, if the queue is full or
+  // closed.
+  template <typename U>
+  bool
+  try_push (U &&elem)
+  {
+    std::unique_lock<std::mutex> lock (mutex_);
+    if (queue_.size () >= capacity_ || closed_)
+      return false;
+
+    queue_.push (std::forward<U> (elem));
+    size_type wake = added (1);
+
+    lock.unlock ();
+    notify (not_empty_cv_, wake);
+
+    return true;
+  }
+
+  template <typename U, typename Duration>
+  bool
+  try_push (U &&elem, const Duration &timeout)
+  {
+    spin_until_not_full ();
+
+    std::unique_lock<std::mutex> lock (mutex_);
+    bool success = wait_for (
+	lock, not_full_cv_, not_full_waiters_, timeout,
+	[this] () { return queue_.size () < capacity_ || closed_; });
+
+    if (!success || closed_)
+      return false;
+
+    queue_.push (std::forward<U> (elem));
+    size_type wake = added (1);
+
+    lock.unlock ();
+    notify (not_empty_cv_, wake);
+
+    return true;
+  }
+
+  // Inserts [first, last) under one lock and wakes consumers once. When the
+  // range does not fit, consumers are woken before waiting for room again.
+  // Returns how many elements were inserted before the queue was closed.
+  // If copying an element throws, those before it stay queued.
+  template <typename InputIt>
+  size_type
+  push_range (InputIt first, InputIt last)
+  {
+    size_type pushed = 0;
+    std::unique_lock<std::mutex> lock (mutex_);
+
+    while (first != last)
+      {
+	wait (lock, not_full_cv_, not_full_waiters_,
+	      [this] () { return queue_.size () < capacity_ || closed_; });
+
+	if (closed_)
+	  break;
+
+	size_type batch = 0;
+	try
+	  {
+	    for (; first != last && queue_.size () < capacity_;
+		 ++first, ++batch)
+	      queue_.push (*first);
+	  }
+	catch (...)
+	  {
+	    // What made it in stays queued, so it must be counted and its
+	    // consumers woken like any other batch.
+	    size_type wake = batch ? added (batch) : 0;
+	    lock.unlock ();
+	    notify (not_empty_cv_, wake);
+	    throw;
+	  }
+
+	pushed += batch;
+	size_type wake = added (batch);
+
+	lock.unlock ();
+	notify (not_empty_cv_, wake);
+	if (first != last)
+	  lock.lock ();
+      }
+
+    return pushed;
+  }
+
+  std::optional<T>
+  pop ()
+  {
+    spin_until_not_empty ();
+
+    std::unique_lock<std::mutex> lock (mutex_);
+    wait (lock, not_empty_cv_, not_empty_waiters_,
+	  [this] { return !queue_.empty () || closed_; });
+
+    if (queue_.empty () && closed_)
+      return std::nullopt;
+
+    std::optional<T> elem (queue_.pop ());
+    size_type wake = removed (1);
+
+    lock.unlock ();
+    notify (not_full_cv_, wake);
+
+    return elem;
+  }
+
+  // Never waits; returns nothing if the queue is empty.
+  std::optional<T>
+  try_pop ()
+  {
+    std::unique_lock<std::mutex> lock (mutex_);
+    if (queue_.empty ())
+      return std::nullopt;
+
+    std::optional<T> elem (queue_.pop ());
+    size_type wake = removed (1);
+
+    lock.unlock ();
+    notify (not_full_cv_, wake);
+
+    return elem;
+  }
+
+  template <typename Duration>
+  std::optional<T>
+  try_pop (const Duration &timeout)
+  {
+    spin_until_not_empty ();
+
+    std::unique_lock<std::mutex> lock (mutex_);
+    bool success = wait_for (lock, not_empty_cv_, not_empty_waiters_, timeout,
+			     [this] { return !queue_.empty () || closed_; });
+
+    if (!success || (queue_.empty () && closed_))
+      return std::nullopt;
+
+    std::optional<T> elem (queue_.pop ());
+    size_type wake = removed (1);
+
+    lock.unlock ();
+    notify (not_full_cv_, wake);
+
+    return elem;
+  }
+
+  // Waits once for the queue to become non-empty, then moves up to n
+  // elements to out under a single lock. Returns 0 once closed and drained.
+  template <typename OutputIt>
+  size_type
+  pop_up_to (size_type n, OutputIt out)
+  {
+    if (n == 0)
+      return 0;
+
+    spin_until_not_empty ();
+
+    std::unique_lock<std::mutex> lock (mutex_);
+    wait (lock, not_empty_cv_, not_empty_waiters_,
+	  [this] { return !queue_.empty () || closed_; });
+
+    return drain (lock, n, out);
+  }
+
+  template <typename OutputIt, typename Duration>
+  size_type
+  try_pop_up_to (size_type n, OutputIt out, const Duration &timeout)
+  {
+    if (n == 0)
+      return 0;
+
+    spin_until_not_empty ();
+
+    std::unique_lock<std::mutex> lock (mutex_);
+    bool success = wait_for (lock, not_empty_cv_, not_empty_waiters_, timeout,
+			     [this] { return !queue_.empty () || closed_; });
+
+    if (!success)
+      return 0;
+
+    return drain (lock, n, out);
+  }
+
+  template <typename OutputIt>
+  size_type
+  pop_all (OutputIt out)
+  {
+    return pop_up_to (std::numeric_limits<size_type>::max (), out);
+  }
+
+  void
+  close ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      closed_ = true;
+      for (queue_notifier *n : notifiers_)
+	n->notify ();
+    }
+    not_empty_cv_.notify_all ();
+    not_full_cv_.notify_all ();
+  }
+
+  // Has n notified whenever the queue turns non-empty or is closed, so a
+  // single thread can wait on several queues (see queue_selector).
+  void
+  attach (queue_notifier &n)
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    notifiers_.push_back (&n);
+  }
+
+  void
+  detach (queue_notifier &n)
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    notifiers_.erase (std::remove (notifiers_.begin (), notifiers_.end (), &n),
+		      notifiers_.end ());
+  }
+
+  size_type
+  size () const
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return queue_.size ();
+  }
+
+  bool
+  empty () const
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return queue_.empty ();
+  }
+
+  bool
+  is_closed () const
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return closed_;
+  }
+
+private:
+  // Waiters register themselves under the lock, so a count of zero seen
+  // under the same lock proves nobody needs a wake-up.
+  template <typename Pred>
+  static void
+  wait (std::unique_lock<std::mutex> &lock, std::condition_variable &cv,
+	size_type &waiters, Pred pred)
+  {
+    while (!pred ())
+      {
+	++waiters;
+	cv.wait (lock);
+	--waiters;
+      }
+  }
+
+  template <typename Duration, typename Pred>
+  static bool
+  wait_for (std::unique_lock<std::mutex> &lock, std::condition_variable &cv,
+	    size_type &waiters, const Duration &timeout, Pred pred)
+  {
+    auto deadline = std::chrono::steady_clock::now () + timeout;
+    while (!pred ())
+      {
+	++waiters;
+	std::cv_status status = cv.wait_until (lock, deadline);
+	--waiters;
+
+	if (status == std::cv_status::timeout)
+	  return pred ();
+      }
+    return true;
+  }
+
+  // Called with the lock held after n elements were added or removed;
+  // return how many waiters on the other side to wake once it is dropped.
+  size_type
+  added (size_type n)
+  {
+    size_.store (queue_.size (), std::memory_order_relaxed);
+
+    // Waiters on a notifier only care about the empty to non-empty edge.
+    if (queue_.size () == n)
+      for (queue_notifier *notifier : notifiers_)
+	notifier->notify ();
+
+    return Notify::on_change (not_empty_cv_, n, not_empty_waiters_);
+  }
+
+  size_type
+  removed (size_type n)
+  {
+    size_.store (queue_.size (), std::memory_order_relaxed);
+
+    return Notify::on_change (not_full_cv_, n, not_full_waiters_);
+  }
+
+  static void
+  notify (std::condition_variable &cv, size_type n)
+  {
+    if (n == 1)
+      cv.notify_one ();
+    else if (n > 1)
+      cv.notify_all ();
+  }
+
+  template <typename OutputIt>
+  size_type
+  drain (std::unique_lock<std::mutex> &lock, size_type n, OutputIt out)
+  {
+    size_type count = std::min (n, queue_.size ());
+    for (size_type i = 0; i < count; i++)
+      {
+	*out++ = queue_.pop ();
+      }
+    size_type wake = removed (count);
+
+    lock.unlock ();
+    notify (not_full_cv_, wake);
+
+    return count;
+  }
+
+  void
+  spin_until_not_empty ()
+  {
+    if (max_spin_)
+      spin ([this] { return size_.load (std::memory_order_relaxed) != 0; });
+  }
+
+  void
+  spin_until_not_full ()
+  {
+    if (max_spin_)
+      spin ([this]
+	      { return size_.load (std::memory_order_relaxed) < capacity_; });
+  }
+
+  // Spins up to twice the running average of successful spins (plus a
+  // floor), so spinning stops paying for itself quickly when the other
+  // side is slow and grows back when it is fast.
+  template <typename Pred>
+  void
+  spin (Pred ready)
+  {
+    unsigned avg = spin_.load (std::memory_order_relaxed);
+    unsigned budget = std::min (avg * 2 + 16, max_spin_);
+
+    for (unsigned i = 0; i < budget; i++)
+      {
+	if (ready ())
+	  {
+	    int delta = static_cast<int> (i) - static_cast<int> (avg);
+	    spin_.store (avg + delta / 8, std::memory_order_relaxed);
+	    return;
+	  }
+	relax ();
+      }
+
+    spin_.store (avg - avg / 8, std::memory_order_relaxed);
+  }
+
+  static void
+  relax ()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause ();
+#elif defined(__aarch64__)
+    asm volatile ("yield");
+#endif
+  }
+
+private:
+  size_type capacity_;
+  Container queue_;
+  mutable std::mutex mutex_;
+
+  // Mirrors queue_.size () for lock-free spinning; only a hint.
+  std::atomic<size_type> size_;
+  unsigned max_spin_;
+  std::atomic<unsigned> spin_;
+
+  bool closed_;
+  size_type not_full_waiters_;
+  size_type not_empty_waiters_;
+  std::condition_variable not_full_cv_;
+  std::condition_variable not_empty_cv_;
+  std::vector<queue_notifier *> notifiers_;
+};
+
+#endif // BASIC_BLOCKING_QUEUE_H
@@ -0,0 +1,126 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+
+// Log-linear histogram in the style of HdrHistogram: every power-of-two
+// range is split into sub_count linear buckets, so any recorded value is
+// reported within 1 / sub_count of its true magnitude.
+class latency_histogram
+{
+public:
+  static constexpr int sub_bits = 5;
+  static constexpr uint64_t sub_count = uint64_t (1) << sub_bits;
+
+  latency_histogram () { reset (); }
+
+  void
+  record (uint64_t value)
+  {
+    counts_[index (value)]++;
+    total_++;
+    sum_ += value;
+    min_ = std::min (min_, value);
+    max_ = std::max (max_, value);
+  }
+
+  void
+  merge (const latency_histogram &other)
+  {
+    for (size_t i = 0; i < counts_.size (); i++)
+      counts_[i] += other.counts_[i];
+    total_ += other.total_;
+    sum_ += other.sum_;
+    min_ = std::min (min_, other.min_);
+    max_ = std::max (max_, other.max_);
+  }
+
+  void
+  reset ()
+  {
+    counts_.fill (0);
+    total_ = 0;
+    sum_ = 0;
+    min_ = std::numeric_limits<uint64_t>::max ();
+    max_ = 0;
+  }
+
+  // Highest value equivalent to the bucket holding the p-th percentile.
+  uint64_t
+  percentile (double p) const
+  {
+    if (total_ == 0)
+      return 0;
+
+    uint64_t rank = static_cast<uint64_t> (p / 100.0 * total_ + 0.5);
+    rank = std::max<uint64_t> (rank, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size (); i++)
+      if ((seen += counts_[i]) >= rank)
+	return std::min (upper_bound (i), max_);
+
+    return max_;
+  }
+
+  uint64_t
+  count () const
+  {
+    return total_;
+  }
+
+  uint64_t
+  min () const
+  {
+    return total_ ? min_ : 0;
+  }
+
+  uint64_t
+  max () const
+  {
+    return max_;
+  }
+
+  double
+  mean () const
+  {
+    return total_ ? static_cast<double> (sum_) / total_ : 0;
+  }
+
+private:
+  static constexpr int buckets = (64 - sub_bits + 1) * sub_count;
+
+  static size_t
+  index (uint64_t value)
+  {
+    int msb = 63 - __builtin_clzll (value | 1);
+    if (msb < sub_bits)
+      return value;
+
+    int shift = msb - sub_bits;
+    return shift * sub_count + (value >> shift);
+  }
+
+  static uint64_t
+  upper_bound (size_t index)
+  {
+    if (index < 2 * sub_count)
+      return index;
+
+    int shift = static_cast<int> (index / sub_count) - 1;
+    uint64_t mantissa = index - shift * sub_count;
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+private:
+  std::array<uint64_t, buckets> counts_;
+  uint64_t total_;
+  uint64_t sum_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+#endif // LATENCY_HISTOGRAM_H
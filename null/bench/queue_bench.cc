@@ -0,0 +1,770 @@
+// Build without CMake: g++ -std=c++17 -O2 -pthread -I.. queue_bench.cc
+//
+// The *_notify_always queues are the blocking queues notifying on every
+// push and pop with the lock held. Comparing their context switches
+// against the plain blocking rows shows what waiter counting and notifying
+// after unlock save.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+#include "concurrent_blocking_queue.h"
+#include "concurrent_lock_free_queue.h"
+#include "dynamic_spsc_ring_buffer.h"
+#include "latency_histogram.h"
+#include "spsc_ring_buffer.h"
+
+using steady_clock = std::chrono::steady_clock;
+
+constexpr size_t queue_capacity = 4096;
+
+template <size_t N>
+struct payload
+{
+  static_assert (N >= sizeof (uint64_t), "payload must hold a sequence");
+
+  unsigned char bytes[N];
+
+  payload () = default;
+  explicit payload (uint64_t seq) { std::memcpy (bytes, &seq, sizeof seq); }
+};
+
+// Spins with a pause hint, then yields so that runs with both threads on
+// one CPU still make progress.
+class spin_wait
+{
+public:
+  void
+  once ()
+  {
+    if (++spins_ < 1024)
+      {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause ();
+#elif defined(__aarch64__)
+	asm volatile ("yield");
+#endif
+      }
+    else
+      std::this_thread::yield ();
+  }
+
+private:
+  unsigned spins_ = 0;
+};
+
+// Adapters give every queue the same spin-until-done push/pop shape so the
+// drivers below stay queue agnostic.
+
+template <typename T>
+struct spsc_adapter
+{
+  static constexpr const char *name = "spsc_ring_buffer";
+
+  spsc_ring_buffer<T, queue_capacity> q;
+
+  void
+  push (const T &v)
+  {
+    for (spin_wait w; !q.push (v);)
+      w.once ();
+  }
+
+  T
+  pop ()
+  {
+    T v;
+    for (spin_wait w; !q.pop (v);)
+      w.once ();
+    return v;
+  }
+};
+
+template <typename T>
+struct dynamic_spsc_adapter
+{
+  static constexpr const char *name = "dynamic_spsc_ring_buffer";
+
+  static constexpr ring_buffer_options options{ page_kind::huge_2mb, true,
+						false };
+
+  dynamic_spsc_ring_buffer<T> q{ queue_capacity, options };
+
+  void
+  push (const T &v)
+  {
+    for (spin_wait w; !q.push (v);)
+      w.once ();
+  }
+
+  T
+  pop ()
+  {
+    T v;
+    for (spin_wait w; !q.pop (v);)
+      w.once ();
+    return v;
+  }
+};
+
+// The baseline the blocking queues' notify_waiters improves on.
+struct notify_always
+{
+  static size_t
+  on_change (std::condition_variable &cv, size_t n, size_t)
+  {
+    if (n == 1)
+      cv.notify_one ();
+    else if (n > 1)
+      cv.notify_all ();
+    return 0;
+  }
+};
+
+template <typename T>
+using notify_always_queue
+    = basic_blocking_queue<T, fifo_container<T>, notify_always>;
+
+template <typename T>
+struct blocking_adapter
+{
+  static constexpr const char *name = "concurrent_blocking_queue";
+
+  concurrent_blocking_queue<T> q{ queue_capacity };
+
+  void
+  push (const T &v)
+  {
+    q.push (v);
+  }
+
+  T
+  pop ()
+  {
+    return *q.pop ();
+  }
+};
+
+template <typename T>
+struct blocking_notify_always_adapter
+{
+  static constexpr const char *name
+      = "concurrent_blocking_queue_notify_always";
+
+  notify_always_queue<T> q{ queue_capacity };
+
+  void
+  push (const T &v)
+  {
+    q.push (v);
+  }
+
+  T
+  pop ()
+  {
+    return *q.pop ();
+  }
+};
+
+template <typename T>
+struct blocking_spin_adapter
+{
+  static constexpr const char *name = "concurrent_blocking_queue_spin";
+
+  concurrent_blocking_queue<T> q{ queue_capacity, 4096 };
+
+  void
+  push (const T &v)
+  {
+    q.push (v);
+  }
+
+  T
+  pop ()
+  {
+    return *q.pop ();
+  }
+};
+
+template <typename T>
+struct blocking_spin_notify_always_adapter
+{
+  static constexpr const char *name
+      = "concurrent_blocking_queue_spin_notify_always";
+
+  notify_always_queue<T> q{ queue_capacity, 4096 };
+
+  void
+  push (const T &v)
+  {
+    q.push (v);
+  }
+
+  T
+  pop ()
+  {
+    return *q.pop ();
+  }
+};
+
+template <typename T>
+struct lock_free_adapter
+{
+  static constexpr const char *name = "concurrent_lock_free_queue";
+
+  concurrent_lock_free_queue<T> q;
+
+  void
+  push (const T &v)
+  {
+    q.push (v);
+  }
+
+  T
+  pop ()
+  {
+    return *q.pop ();
+  }
+};
+
+struct cpu_info
+{
+  int cpu;
+  int core;
+  int package;
+};
+
+static int
+read_int (const std::string &path)
+{
+  std::ifstream in (path);
+  int v = -1;
+  in >> v;
+  return v;
+}
+
+// CPUs in allowed, with -1 for a core or package that sysfs does not tell.
+static std::vector<cpu_info>
+read_topology (const cpu_set_t &allowed)
+{
+  std::vector<cpu_info> cpus;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if (!CPU_ISSET (cpu, &allowed))
+	continue;
+
+      std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string (cpu)
+			+ "/topology/";
+      cpus.push_back ({ cpu, read_int (dir + "core_id"),
+			read_int (dir + "physical_package_id") });
+    }
+
+  return cpus;
+}
+
+static bool
+topology_known (const std::vector<cpu_info> &cpus)
+{
+  for (const auto &x : cpus)
+    if (x.core < 0 || x.package < 0)
+      return false;
+  return !cpus.empty ();
+}
+
+// Resolves a placement name to a producer/consumer CPU pair. "none" leaves
+// scheduling to the kernel, "smt" picks two hyperthreads of one core, "core"
+// two cores of one package, "socket" two packages, and "A:B" is explicit.
+// The named placements need the topology; without it every CPU would look
+// like a sibling of every other.
+static bool
+pick_cpus (const std::vector<cpu_info> &cpus, const std::string &placement,
+	   int &a, int &b)
+{
+  a = b = -1;
+  if (placement == "none")
+    return true;
+
+  if (placement.find (':') != std::string::npos)
+    return std::sscanf (placement.c_str (), "%d:%d", &a, &b) == 2;
+
+  if (!topology_known (cpus))
+    return false;
+
+  for (const auto &x : cpus)
+    for (const auto &y : cpus)
+      {
+	if (x.cpu == y.cpu)
+	  continue;
+
+	bool same_package = x.package == y.package;
+	bool same_core = same_package && x.core == y.core;
+
+	if ((placement == "smt" && same_core)
+	    || (placement == "core" && same_package && !same_core)
+	    || (placement == "socket" && !same_package))
+	  {
+	    a = x.cpu;
+	    b = y.cpu;
+	    return true;
+	  }
+      }
+
+  return false;
+}
+
+static bool
+set_affinity (const cpu_set_t &set)
+{
+  return pthread_setaffinity_np (pthread_self (), sizeof set, &set) == 0;
+}
+
+// A cpu of -1 leaves the thread as it is.
+static bool
+pin_this_thread (int cpu)
+{
+  if (cpu < 0)
+    return true;
+  if (cpu >= CPU_SETSIZE)
+    return false;
+
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  CPU_SET (cpu, &set);
+  return set_affinity (set);
+}
+
+// Pins the calling thread to each of a and b in turn, so that a placement
+// the kernel refuses is skipped before it is measured, and then restores
+// allowed.
+static bool
+can_pin (int a, int b, const cpu_set_t &allowed)
+{
+  bool ok = pin_this_thread (a) && pin_this_thread (b);
+  set_affinity (allowed);
+  return ok;
+}
+
+// Records a pin that failed during a run, so that the result does not
+// claim a placement it did not get.
+static void
+pin_or_report (int &cpu)
+{
+  if (pin_this_thread (cpu))
+    return;
+
+  std::fprintf (stderr, "cannot pin to CPU %d, running unpinned\n", cpu);
+  cpu = -1;
+}
+
+struct result
+{
+  std::string queue;
+  std::string test;
+  std::string placement;
+  int producer_cpu;
+  int consumer_cpu;
+  size_t elem_size;
+  uint64_t ops;
+  double seconds;
+  latency_histogram latency;
+  long voluntary_switches;
+  long involuntary_switches;
+};
+
+struct switch_totals
+{
+  std::atomic<long> voluntary{ 0 };
+  std::atomic<long> involuntary{ 0 };
+
+  void
+  store (result &res) const
+  {
+    res.voluntary_switches = voluntary.load ();
+    res.involuntary_switches = involuntary.load ();
+  }
+};
+
+// Counts the calling thread's context switches over its lifetime. Blocking
+// on a futex shows up as a voluntary switch, so the delta doubles as a
+// proxy for sleeping and wake-up syscalls.
+class switch_counter
+{
+public:
+  explicit switch_counter (switch_totals &totals) : totals_ (totals)
+  {
+    sample (start_);
+  }
+
+  ~switch_counter ()
+  {
+    struct rusage end;
+    sample (end);
+    totals_.voluntary += end.ru_nvcsw - start_.ru_nvcsw;
+    totals_.involuntary += end.ru_nivcsw - start_.ru_nivcsw;
+  }
+
+private:
+  static void
+  sample (struct rusage &usage)
+  {
+    getrusage (RUSAGE_THREAD, &usage);
+  }
+
+private:
+  switch_totals &totals_;
+  struct rusage start_;
+};
+
+// Releases both threads at once after they have been pinned.
+class start_gate
+{
+public:
+  void
+  arrive_and_wait ()
+  {
+    arrived_.fetch_add (1);
+    for (spin_wait w; arrived_.load () < 2;)
+      w.once ();
+  }
+
+private:
+  std::atomic<int> arrived_{ 0 };
+};
+
+template <template <typename> class Queue, size_t N>
+void
+run_throughput (uint64_t ops, result &res)
+{
+  using T = payload<N>;
+  auto q = std::make_unique<Queue<T>> ();
+  start_gate gate;
+  switch_totals switches;
+  steady_clock::time_point begin, end;
+
+  std::thread producer (
+      [&] ()
+	{
+	  pin_or_report (res.producer_cpu);
+	  gate.arrive_and_wait ();
+	  switch_counter counter (switches);
+	  for (uint64_t i = 0; i < ops; i++)
+	    q->push (T (i));
+	});
+
+  pin_or_report (res.consumer_cpu);
+  gate.arrive_and_wait ();
+  {
+    switch_counter counter (switches);
+    begin = steady_clock::now ();
+    for (uint64_t i = 0; i < ops; i++)
+      q->pop ();
+    end = steady_clock::now ();
+  }
+
+  producer.join ();
+  switches.store (res);
+
+  res.ops = ops;
+  res.seconds = std::chrono::duration<double> (end - begin).count ();
+}
+
+template <template <typename> class Queue, size_t N>
+void
+run_pingpong (uint64_t ops, result &res)
+{
+  using T = payload<N>;
+  auto ping = std::make_unique<Queue<T>> ();
+  auto pong = std::make_unique<Queue<T>> ();
+  uint64_t warmup = ops / 10;
+  start_gate gate;
+  switch_totals switches;
+  steady_clock::time_point begin, end;
+
+  std::thread echo (
+      [&] ()
+	{
+	  pin_or_report (res.consumer_cpu);
+	  gate.arrive_and_wait ();
+	  switch_counter counter (switches);
+	  for (uint64_t i = 0; i < warmup + ops; i++)
+	    pong->push (ping->pop ());
+	});
+
+  pin_or_report (res.producer_cpu);
+  gate.arrive_and_wait ();
+  {
+    switch_counter counter (switches);
+    for (uint64_t i = 0; i < warmup + ops; i++)
+      {
+	if (i == warmup)
+	  begin = steady_clock::now ();
+
+	auto t0 = steady_clock::now ();
+	ping->push (T (i));
+	pong->pop ();
+	auto t1 = steady_clock::now ();
+
+	if (i >= warmup)
+	  res.latency.record (
+	      std::chrono::duration_cast<std::chrono::nanoseconds> (t1 - t0)
+		  .count ());
+      }
+    end = steady_clock::now ();
+  }
+
+  echo.join ();
+  switches.store (res);
+
+  res.ops = ops;
+  res.seconds = std::chrono::duration<double> (end - begin).count ();
+}
+
+static void
+print_csv (const std::vector<result> &results)
+{
+  std::printf ("queue,test,placement,producer_cpu,consumer_cpu,elem_size,"
+	       "ops,seconds,mops,voluntary_switches,involuntary_switches,"
+	       "p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+
+  for (const auto &r : results)
+    {
+      std::printf ("%s,%s,%s,%d,%d,%zu,%llu,%.6f,%.3f,%ld,%ld",
+		   r.queue.c_str (), r.test.c_str (), r.placement.c_str (),
+		   r.producer_cpu, r.consumer_cpu, r.elem_size,
+		   (unsigned long long) r.ops, r.seconds,
+		   r.ops / r.seconds / 1e6, r.voluntary_switches,
+		   r.involuntary_switches);
+
+      if (r.latency.count ())
+	std::printf (",%llu,%llu,%llu,%llu,%llu\n",
+		     (unsigned long long) r.latency.percentile (50),
+		     (unsigned long long) r.latency.percentile (90),
+		     (unsigned long long) r.latency.percentile (99),
+		     (unsigned long long) r.latency.percentile (99.9),
+		     (unsigned long long) r.latency.max ());
+      else
+	std::printf (",,,,,\n");
+    }
+}
+
+static void
+print_json (const std::vector<result> &results)
+{
+  std::printf ("[\n");
+
+  for (size_t i = 0; i < results.size (); i++)
+    {
+      const auto &r = results[i];
+      std::printf ("  {\"queue\": \"%s\", \"test\": \"%s\", "
+		   "\"placement\": \"%s\", \"producer_cpu\": %d, "
+		   "\"consumer_cpu\": %d, \"elem_size\": %zu, "
+		   "\"ops\": %llu, \"seconds\": %.6f, \"mops\": %.3f, "
+		   "\"voluntary_switches\": %ld, "
+		   "\"involuntary_switches\": %ld",
+		   r.queue.c_str (), r.test.c_str (), r.placement.c_str (),
+		   r.producer_cpu, r.consumer_cpu, r.elem_size,
+		   (unsigned long long) r.ops, r.seconds,
+		   r.ops / r.seconds / 1e6, r.voluntary_switches,
+		   r.involuntary_switches);
+
+      if (r.latency.count ())
+	std::printf (", \"latency_ns\": {\"min\": %llu, \"mean\": %.1f, "
+		     "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+		     "\"p999\": %llu, \"max\": %llu}",
+		     (unsigned long long) r.latency.min (), r.latency.mean (),
+		     (unsigned long long) r.latency.percentile (50),
+		     (unsigned long long) r.latency.percentile (90),
+		     (unsigned long long) r.latency.percentile (99),
+		     (unsigned long long) r.latency.percentile (99.9),
+		     (unsigned long long) r.latency.max ());
+
+      std::printf ("}%s\n", i + 1 < results.size () ? "," : "");
+    }
+
+  std::printf ("]\n");
+}
+
+struct options
+{
+  std::vector<std::string> queues{ "spsc", "dynamic_spsc", "blocking",
+				   "blocking_spin", "lock_free" };
+  std::vector<std::string> tests{ "throughput", "pingpong" };
+  std::vector<std::string> placements{ "none", "smt", "core", "socket" };
+  uint64_t ops = 1000000;
+  bool json = false;
+};
+
+static std::vector<std::string>
+split (const char *arg)
+{
+  std::vector<std::string> out;
+  std::string s (arg);
+  for (size_t pos = 0, next; pos <= s.size (); pos = next + 1)
+    {
+      next = s.find (',', pos);
+      if (next == std::string::npos)
+	next = s.size ();
+      out.push_back (s.substr (pos, next - pos));
+    }
+  return out;
+}
+
+static void
+usage (const char *prog)
+{
+  std::printf ("Usage: %s [options]\n"
+	       "  --queues    spsc,dynamic_spsc,blocking,blocking_spin,\n"
+	       "              blocking_notify_always,"
+	       "blocking_spin_notify_always,\n"
+	       "              lock_free\n"
+	       "  --tests     throughput,pingpong\n"
+	       "  --placement none,smt,core,socket,A:B\n"
+	       "  --ops       messages per run (pingpong uses ops / 10)\n"
+	       "  --json      emit JSON instead of CSV\n",
+	       prog);
+}
+
+static bool
+parse (int argc, char **argv, options &opts)
+{
+  for (int i = 1; i < argc; i++)
+    {
+      bool has_value = i + 1 < argc;
+
+      if (!std::strcmp (argv[i], "--queues") && has_value)
+	opts.queues = split (argv[++i]);
+      else if (!std::strcmp (argv[i], "--tests") && has_value)
+	opts.tests = split (argv[++i]);
+      else if (!std::strcmp (argv[i], "--placement") && has_value)
+	opts.placements = split (argv[++i]);
+      else if (!std::strcmp (argv[i], "--ops") && has_value)
+	opts.ops = std::strtoull (argv[++i], nullptr, 10);
+      else if (!std::strcmp (argv[i], "--json"))
+	opts.json = true;
+      else
+	return false;
+    }
+
+  return opts.ops > 0;
+}
+
+template <template <typename> class Queue, size_t N>
+void
+run_one (const std::string &test, uint64_t ops, result &res)
+{
+  res.queue = Queue<payload<N>>::name;
+  res.elem_size = N;
+  res.test = test;
+
+  if (test == "throughput")
+    run_throughput<Queue, N> (ops, res);
+  else
+    run_pingpong<Queue, N> (ops / 10, res);
+}
+
+template <template <typename> class Queue>
+void
+run_sizes (const options &opts, const std::string &placement, int pcpu,
+	   int ccpu, std::vector<result> &results)
+{
+  for (const auto &test : opts.tests)
+    {
+      if (test != "throughput" && test != "pingpong")
+	continue;
+
+      result r8{}, r64{}, r256{};
+      for (result *r : { &r8, &r64, &r256 })
+	{
+	  r->placement = placement;
+	  r->producer_cpu = pcpu;
+	  r->consumer_cpu = ccpu;
+	}
+
+      run_one<Queue, 8> (test, opts.ops, r8);
+      run_one<Queue, 64> (test, opts.ops, r64);
+      run_one<Queue, 256> (test, opts.ops, r256);
+
+      results.push_back (std::move (r8));
+      results.push_back (std::move (r64));
+      results.push_back (std::move (r256));
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  options opts;
+  if (!parse (argc, argv, opts))
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  cpu_set_t allowed;
+  CPU_ZERO (&allowed);
+  sched_getaffinity (0, sizeof allowed, &allowed);
+
+  auto cpus = read_topology (allowed);
+  std::vector<result> results;
+
+  for (const auto &placement : opts.placements)
+    {
+      int pcpu, ccpu;
+      if (!pick_cpus (cpus, placement, pcpu, ccpu)
+	  || !can_pin (pcpu, ccpu, allowed))
+	{
+	  std::fprintf (stderr, "skipping placement %s: not available\n",
+			placement.c_str ());
+	  continue;
+	}
+
+      // The runs leave this thread pinned, and threads started from it
+      // inherit that; "none" must start from every allowed CPU again.
+      set_affinity (allowed);
+
+      for (const auto &queue : opts.queues)
+	{
+	  if (queue == "spsc")
+	    run_sizes<spsc_adapter> (opts, placement, pcpu, ccpu, results);
+	  else if (queue == "dynamic_spsc")
+	    run_sizes<dynamic_spsc_adapter> (opts, placement, pcpu, ccpu,
+					     results);
+	  else if (queue == "blocking")
+	    run_sizes<blocking_adapter> (opts, placement, pcpu, ccpu,
+					 results);
+	  else if (queue == "blocking_spin")
+	    run_sizes<blocking_spin_adapter> (opts, placement, pcpu, ccpu,
+					      results);
+	  else if (queue == "blocking_notify_always")
+	    run_sizes<blocking_notify_always_adapter> (opts, placement, pcpu,
+						       ccpu, results);
+	  else if (queue == "blocking_spin_notify_always")
+	    run_sizes<blocking_spin_notify_always_adapter> (
+		opts, placement, pcpu, ccpu, results);
+	  else if (queue == "lock_free")
+	    run_sizes<lock_free_adapter> (opts, placement, pcpu, ccpu,
+					  results);
+	  else
+	    std::fprintf (stderr, "unknown queue %s\n", queue.c_str ());
+	}
+    }
+
+  if (opts.json)
+    print_json (results);
+  else
+    print_csv (results);
+}
@@ -0,0 +1,298 @@
+// Build without CMake: g++ -std=c++17 -O2 -pthread -I.. reclaim_bench.cc
+//
+// Reader overhead of the reclamation schemes: every reader repeatedly
+// reaches a shared object through an atomic pointer that a writer replaces
+// at a fixed interval, and sums a field of it. The refcount baseline is
+// atomic_shared_ptr, whose load () pays two atomic read-modify-writes on
+// the object's count for every read.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "atomic_shared_ptr.h"
+#include "reclamation.h"
+
+using steady_clock = std::chrono::steady_clock;
+
+struct object
+{
+  explicit object (uint64_t v) : value{ v } {}
+
+  uint64_t value;
+};
+
+struct refcount_scheme
+{
+  static constexpr const char *name = "refcount";
+
+  atomic_shared_ptr<object> p{ shared_ptr<object>{ new object{ 1 } } };
+
+  uint64_t
+  read ()
+  {
+    return p.load ()->value;
+  }
+
+  void
+  update (uint64_t v)
+  {
+    p.store (shared_ptr<object>{ new object{ v } });
+  }
+};
+
+struct hazard_scheme
+{
+  static constexpr const char *name = "hazard";
+
+  std::atomic<object *> p{ new object{ 1 } };
+
+  ~hazard_scheme () { delete p.load (); }
+
+  uint64_t
+  read ()
+  {
+    hazard_pointer hp;
+    return hp.protect (p)->value;
+  }
+
+  void
+  update (uint64_t v)
+  {
+    hazard_domain::global ().retire (p.exchange (new object{ v }));
+  }
+};
+
+struct epoch_scheme
+{
+  static constexpr const char *name = "epoch";
+
+  std::atomic<object *> p{ new object{ 1 } };
+
+  ~epoch_scheme () { delete p.load (); }
+
+  uint64_t
+  read ()
+  {
+    epoch_guard guard;
+    return p.load (std::memory_order_acquire)->value;
+  }
+
+  void
+  update (uint64_t v)
+  {
+    epoch_domain::global ().retire (p.exchange (new object{ v }));
+  }
+};
+
+struct result
+{
+  std::string scheme;
+  unsigned readers;
+  uint64_t update_us;
+  uint64_t ops;
+  double seconds;
+  uint64_t updates;
+};
+
+template <class Scheme>
+void
+run (unsigned readers, uint64_t ops, uint64_t update_us, result &res)
+{
+  Scheme s;
+  std::atomic<unsigned> ready{ 0 };
+  std::atomic<unsigned> done{ 0 };
+  std::atomic<uint64_t> sink{ 0 };
+  std::vector<std::thread> threads;
+
+  for (unsigned i = 0; i < readers; i++)
+    threads.emplace_back (
+	[&] ()
+	  {
+	    ready.fetch_add (1);
+	    while (ready.load () <= readers)
+	      std::this_thread::yield ();
+
+	    uint64_t sum = 0;
+	    for (uint64_t n = 0; n < ops; n++)
+	      sum += s.read ();
+	    sink.fetch_add (sum, std::memory_order_relaxed);
+	    done.fetch_add (1);
+	  });
+
+  while (ready.load () < readers)
+    std::this_thread::yield ();
+
+  auto begin = steady_clock::now ();
+  ready.fetch_add (1);
+
+  // The writer runs on this thread so that it does not count as a reader.
+  uint64_t updates = 0;
+  while (done.load () < readers)
+    {
+      if (update_us)
+	{
+	  std::this_thread::sleep_for (std::chrono::microseconds (update_us));
+	  s.update (++updates + 1);
+	}
+      else
+	std::this_thread::yield ();
+    }
+  auto end = steady_clock::now ();
+
+  for (auto &t : threads)
+    t.join ();
+
+  res.scheme = Scheme::name;
+  res.readers = readers;
+  res.update_us = update_us;
+  res.ops = ops * readers;
+  res.seconds = std::chrono::duration<double> (end - begin).count ();
+  res.updates = updates;
+}
+
+static void
+print_csv (const std::vector<result> &results)
+{
+  std::printf ("scheme,readers,update_us,ops,seconds,ns_per_read,mops,"
+	       "updates\n");
+
+  for (const auto &r : results)
+    std::printf ("%s,%u,%llu,%llu,%.6f,%.2f,%.3f,%llu\n", r.scheme.c_str (),
+		 r.readers, (unsigned long long) r.update_us,
+		 (unsigned long long) r.ops, r.seconds,
+		 r.seconds * 1e9 * r.readers / r.ops,
+		 r.ops / r.seconds / 1e6, (unsigned long long) r.updates);
+}
+
+static void
+print_json (const std::vector<result> &results)
+{
+  std::printf ("[\n");
+
+  for (size_t i = 0; i < results.size (); i++)
+    {
+      const auto &r = results[i];
+      std::printf ("  {\"scheme\": \"%s\", \"readers\": %u, "
+		   "\"update_us\": %llu, \"ops\": %llu, "
+		   "\"seconds\": %.6f, \"ns_per_read\": %.2f, "
+		   "\"mops\": %.3f, \"updates\": %llu}%s\n",
+		   r.scheme.c_str (), r.readers,
+		   (unsigned long long) r.update_us,
+		   (unsigned long long) r.ops, r.seconds,
+		   r.seconds * 1e9 * r.readers / r.ops,
+		   r.ops / r.seconds / 1e6, (unsigned long long) r.updates,
+		   i + 1 < results.size () ? "," : "");
+    }
+
+  std::printf ("]\n");
+}
+
+struct options
+{
+  std::vector<std::string> schemes{ "refcount", "hazard", "epoch" };
+  std::vector<unsigned> readers{ 1, 2, 4 };
+  uint64_t ops = 10000000;
+  uint64_t update_us = 100;
+  bool json = false;
+};
+
+static std::vector<std::string>
+split (const char *arg)
+{
+  std::vector<std::string> out;
+  std::string s (arg);
+  for (size_t pos = 0, next; pos <= s.size (); pos = next + 1)
+    {
+      next = s.find (',', pos);
+      if (next == std::string::npos)
+	next = s.size ();
+      out.push_back (s.substr (pos, next - pos));
+    }
+  return out;
+}
+
+static void
+usage (const char *prog)
+{
+  std::printf ("Usage: %s [options]\n"
+	       "  --schemes   refcount,hazard,epoch\n"
+	       "  --readers   reader thread counts, e.g. 1,2,4\n"
+	       "  --ops       reads per reader\n"
+	       "  --update-us writer interval in microseconds, 0 for none\n"
+	       "  --json      emit JSON instead of CSV\n",
+	       prog);
+}
+
+static bool
+parse (int argc, char **argv, options &opts)
+{
+  for (int i = 1; i < argc; i++)
+    {
+      bool has_value = i + 1 < argc;
+
+      if (!std::strcmp (argv[i], "--schemes") && has_value)
+	opts.schemes = split (argv[++i]);
+      else if (!std::strcmp (argv[i], "--readers") && has_value)
+	{
+	  opts.readers.clear ();
+	  for (const auto &n : split (argv[++i]))
+	    opts.readers.push_back (std::strtoul (n.c_str (), nullptr, 10));
+	}
+      else if (!std::strcmp (argv[i], "--ops") && has_value)
+	opts.ops = std::strtoull (argv[++i], nullptr, 10);
+      else if (!std::strcmp (argv[i], "--update-us") && has_value)
+	opts.update_us = std::strtoull (argv[++i], nullptr, 10);
+      else if (!std::strcmp (argv[i], "--json"))
+	opts.json = true;
+      else
+	return false;
+    }
+
+  for (unsigned n : opts.readers)
+    if (n == 0)
+      return false;
+  return opts.ops > 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  options opts;
+  if (!parse (argc, argv, opts))
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  std::vector<result> results;
+
+  for (unsigned readers : opts.readers)
+    for (const auto &scheme : opts.schemes)
+      {
+	result r{};
+	if (scheme == "refcount")
+	  run<refcount_scheme> (readers, opts.ops, opts.update_us, r);
+	else if (scheme == "hazard")
+	  run<hazard_scheme> (readers, opts.ops, opts.update_us, r);
+	else if (scheme == "epoch")
+	  run<epoch_scheme> (readers, opts.ops, opts.update_us, r);
+	else
+	  {
+	    std::fprintf (stderr, "unknown scheme %s\n", scheme.c_str ());
+	    continue;
+	  }
+	results.push_back (std::move (r));
+      }
+
+  if (opts.json)
+    print_json (results);
+  else
+    print_csv (results);
+}
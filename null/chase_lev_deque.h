@@ -0,0 +1,166 @@
+#ifndef CHASE_LEV_DEQUE_H
+#define CHASE_LEV_DEQUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+// Work-stealing deque after Chase and Lev, with the C11 orderings of Lê et
+// al. The owning thread pushes and pops at the bottom without any atomic
+// read-modify-write except when racing a thief for the last element; any
+// number of thieves take from the top with a single CAS. The buffer grows
+// when full; outgrown buffers stay alive until the deque is destroyed,
+// since a thief may still be reading from one.
+template <typename T>
+class chase_lev_deque
+{
+  static_assert (std::is_trivially_copyable<T>::value,
+		 "Elements are copied through std::atomic.");
+
+public:
+  using element_type = T;
+  using size_type = size_t;
+
+  explicit chase_lev_deque (size_type capacity = 256)
+      : top_ (0), bottom_ (0)
+  {
+    size_type size = 1;
+    while (size < capacity)
+      size <<= 1;
+
+    buffers_.emplace_back (new buffer (size));
+    buffer_.store (buffers_.back ().get (), std::memory_order_relaxed);
+  }
+
+  chase_lev_deque (const chase_lev_deque &) = delete;
+  chase_lev_deque &operator= (const chase_lev_deque &) = delete;
+
+  // Owner only.
+  void
+  push (T elem)
+  {
+    int64_t b = bottom_.load (std::memory_order_relaxed);
+    int64_t t = top_.load (std::memory_order_acquire);
+    buffer *buf = buffer_.load (std::memory_order_relaxed);
+
+    if (b - t > static_cast<int64_t> (buf->mask))
+      buf = grow (buf, t, b);
+
+    buf->put (b, elem);
+    bottom_.store (b + 1, std::memory_order_release);
+  }
+
+  // Owner only. Takes the most recently pushed element.
+  std::optional<T>
+  pop ()
+  {
+    int64_t b = bottom_.load (std::memory_order_relaxed) - 1;
+    buffer *buf = buffer_.load (std::memory_order_relaxed);
+    bottom_.store (b, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    int64_t t = top_.load (std::memory_order_relaxed);
+
+    if (t > b)
+      {
+	bottom_.store (b + 1, std::memory_order_relaxed);
+	return std::nullopt;
+      }
+
+    std::optional<T> elem (buf->get (b));
+    if (t == b)
+      {
+	// Last element: whoever moves top_ first gets it.
+	if (!top_.compare_exchange_strong (t, t + 1,
+					   std::memory_order_seq_cst,
+					   std::memory_order_relaxed))
+	  elem.reset ();
+	bottom_.store (b + 1, std::memory_order_relaxed);
+      }
+    return elem;
+  }
+
+  // Any thread. Takes the oldest element; returns nothing if the deque is
+  // empty or another thief won the race for it.
+  std::optional<T>
+  steal ()
+  {
+    int64_t t = top_.load (std::memory_order_acquire);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    int64_t b = bottom_.load (std::memory_order_acquire);
+
+    if (t >= b)
+      return std::nullopt;
+
+    buffer *buf = buffer_.load (std::memory_order_acquire);
+    T elem = buf->get (t);
+    if (!top_.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst,
+				       std::memory_order_relaxed))
+      return std::nullopt;
+
+    return elem;
+  }
+
+  // Approximate unless called by the owner with no thieves around.
+  size_type
+  size () const
+  {
+    int64_t b = bottom_.load (std::memory_order_relaxed);
+    int64_t t = top_.load (std::memory_order_relaxed);
+    return b > t ? static_cast<size_type> (b - t) : 0;
+  }
+
+  bool
+  empty () const
+  {
+    return size () == 0;
+  }
+
+private:
+  struct buffer
+  {
+    explicit buffer (size_type size)
+	: mask (size - 1), slots (new std::atomic<T>[size])
+    {
+    }
+
+    T
+    get (int64_t i) const
+    {
+      return slots[i & mask].load (std::memory_order_relaxed);
+    }
+
+    void
+    put (int64_t i, T elem)
+    {
+      slots[i & mask].store (elem, std::memory_order_relaxed);
+    }
+
+    const size_type mask;
+    std::unique_ptr<std::atomic<T>[]> slots;
+  };
+
+  buffer *
+  grow (buffer *old, int64_t t, int64_t b)
+  {
+    buffers_.emplace_back (new buffer ((old->mask + 1) * 2));
+    buffer *buf = buffers_.back ().get ();
+
+    for (int64_t i = t; i < b; i++)
+      buf->put (i, old->get (i));
+
+    buffer_.store (buf, std::memory_order_release);
+    return buf;
+  }
+
+private:
+  alignas (64) std::atomic<int64_t> top_;
+  alignas (64) std::atomic<int64_t> bottom_;
+  std::atomic<buffer *> buffer_;
+  std::vector<std::unique_ptr<buffer>> buffers_;
+};
+
+#endif // CHASE_LEV_DEQUE_H
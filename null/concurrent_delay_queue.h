@@ -0,0 +1,178 @@
+#ifndef CONCURRENT_DELAY_QUEUE_H
+#define CONCURRENT_DELAY_QUEUE_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "d_ary_heap.h"
+
+// Unbounded queue whose elements only become poppable once their deadline
+// has passed; pop () sleeps until the earliest one is due. Elements with
+// equal deadlines come out in push order. After close (), whatever is left
+// is handed out immediately, without waiting for the deadlines, so that
+// workers can drain and exit.
+template <typename T>
+class concurrent_delay_queue
+{
+public:
+  using element_type = T;
+  using size_type = size_t;
+  using clock = std::chrono::steady_clock;
+  using time_point = clock::time_point;
+
+  concurrent_delay_queue () : seq_ (0), closed_ (false), waiters_ (0) {}
+
+  concurrent_delay_queue (const concurrent_delay_queue &) = delete;
+  concurrent_delay_queue &operator= (const concurrent_delay_queue &) = delete;
+
+  template <typename U>
+  bool
+  push (U &&elem, time_point deadline)
+  {
+    std::unique_lock<std::mutex> lock (mutex_);
+    if (closed_)
+      return false;
+
+    uint64_t seq = seq_++;
+    heap_.push (entry{ deadline, seq, std::forward<U> (elem) });
+
+    // Sleepers are timed on the old earliest deadline; only a new earliest
+    // element makes them wake too late.
+    bool wake = waiters_ > 0 && heap_.top ().seq == seq;
+
+    lock.unlock ();
+    if (wake)
+      cv_.notify_one ();
+
+    return true;
+  }
+
+  template <typename U, typename Rep, typename Period>
+  bool
+  push (U &&elem, const std::chrono::duration<Rep, Period> &delay)
+  {
+    return push (std::forward<U> (elem),
+		 clock::now ()
+		     + std::chrono::duration_cast<clock::duration> (delay));
+  }
+
+  std::optional<T>
+  pop ()
+  {
+    return pop_until (nullptr);
+  }
+
+  template <typename Duration>
+  std::optional<T>
+  try_pop (const Duration &timeout)
+  {
+    time_point limit = clock::now ()
+		       + std::chrono::duration_cast<clock::duration> (timeout);
+    return pop_until (&limit);
+  }
+
+  void
+  close ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      closed_ = true;
+    }
+    cv_.notify_all ();
+  }
+
+  size_type
+  size () const
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return heap_.size ();
+  }
+
+  bool
+  empty () const
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return heap_.empty ();
+  }
+
+  bool
+  is_closed () const
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return closed_;
+  }
+
+private:
+  struct entry
+  {
+    time_point deadline;
+    uint64_t seq;
+    T value;
+  };
+
+  struct later
+  {
+    bool
+    operator() (const entry &a, const entry &b) const
+    {
+      if (a.deadline != b.deadline)
+	return a.deadline > b.deadline;
+      return a.seq > b.seq;
+    }
+  };
+
+  std::optional<T>
+  pop_until (const time_point *limit)
+  {
+    std::unique_lock<std::mutex> lock (mutex_);
+
+    for (;;)
+      {
+	time_point now = clock::now ();
+	if (!heap_.empty () && (closed_ || heap_.top ().deadline <= now))
+	  break;
+
+	if ((heap_.empty () && closed_) || (limit && now >= *limit))
+	  return std::nullopt;
+
+	++waiters_;
+	if (heap_.empty () && !limit)
+	  cv_.wait (lock);
+	else
+	  {
+	    time_point until = heap_.empty () ? *limit : heap_.top ().deadline;
+	    if (limit)
+	      until = std::min (until, *limit);
+	    cv_.wait_until (lock, until);
+	  }
+	--waiters_;
+      }
+
+    entry e = heap_.pop ();
+
+    // Another sleeper may have been timed on the element just taken.
+    bool wake = waiters_ > 0 && !heap_.empty ();
+
+    lock.unlock ();
+    if (wake)
+      cv_.notify_one ();
+
+    return std::optional<T> (std::move (e.value));
+  }
+
+private:
+  d_ary_heap<entry, later> heap_;
+  mutable std::mutex mutex_;
+  uint64_t seq_;
+
+  bool closed_;
+  size_type waiters_;
+  std::condition_variable cv_;
+};
+
+#endif // CONCURRENT_DELAY_QUEUE_H
@@ -0,0 +1,397 @@
+#ifndef CONCURRENT_LOCK_FREE_QUEUE_H
+#define CONCURRENT_LOCK_FREE_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include "reclamation.h"
+
+// Unbounded MPMC queue with the push/pop/try_pop/close surface of
+// concurrent_blocking_queue. Elements live inline in a linked list of
+// fixed-size segments; producers and consumers claim slots with a single
+// fetch_add each, so neither side ever takes a lock. Consumers that find
+// the queue empty park on a condition variable that producers only touch
+// when somebody is actually parked. Segments the consumers have left
+// behind are reclaimed through epoch_domain.
+template <typename T>
+class concurrent_lock_free_queue
+{
+public:
+  using element_type = T;
+  using size_type = size_t;
+
+  concurrent_lock_free_queue ()
+      : head_ (new segment (0)), tail_ (head_.load ()), pushers_ (0),
+	closed_ (false), sleepers_ (0), epoch_ (0)
+  {
+  }
+
+  ~concurrent_lock_free_queue ()
+  {
+    for (segment *seg = head_.load (); seg;)
+      {
+	size_type end = std::min (seg->enq_idx.load (), segment_size);
+	for (size_type i = seg->deq_idx.load (); i < end; i++)
+	  if (seg->slots[i].state.load () == slot_ready)
+	    seg->slots[i].get ()->~T ();
+
+	segment *next = seg->next.load ();
+	delete seg;
+	seg = next;
+      }
+  }
+
+  concurrent_lock_free_queue (const concurrent_lock_free_queue &) = delete;
+  concurrent_lock_free_queue &operator= (const concurrent_lock_free_queue &)
+      = delete;
+
+  template <typename U>
+  bool
+  push (U &&elem)
+  {
+    // A push is either visible to consumers before they observe the queue
+    // as closed and drained, or it sees the close and backs out.
+    {
+      pusher_guard pusher (pushers_);
+      if (closed_.load ())
+	return false;
+
+      epoch_guard guard;
+      enqueue (std::forward<U> (elem));
+    }
+
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (sleepers_.load (std::memory_order_relaxed) > 0)
+      wake (false);
+
+    return true;
+  }
+
+  // The queue is unbounded, so this never waits; it exists so the queue can
+  // stand in for concurrent_blocking_queue.
+  template <typename U, typename Duration>
+  bool
+  try_push (U &&elem, const Duration & /*timeout*/)
+  {
+    return push (std::forward<U> (elem));
+  }
+
+  std::optional<T>
+  pop ()
+  {
+    return pop_until (nullptr);
+  }
+
+  template <typename Duration>
+  std::optional<T>
+  try_pop (const Duration &timeout)
+  {
+    auto deadline = std::chrono::steady_clock::now () + timeout;
+    return pop_until (&deadline);
+  }
+
+  // Returns at once when the queue looks empty instead of spinning and
+  // parking.
+  std::optional<T>
+  try_pop ()
+  {
+    return dequeue ();
+  }
+
+  void
+  close ()
+  {
+    closed_.store (true);
+    wake (true);
+  }
+
+  // Approximate while producers and consumers are active.
+  size_type
+  size () const
+  {
+    epoch_guard guard;
+    segment *head = head_.load ();
+    segment *tail = tail_.load ();
+
+    size_type first = head->id * segment_size
+		      + std::min (head->deq_idx.load (), segment_size);
+    size_type last = tail->id * segment_size
+		     + std::min (tail->enq_idx.load (), segment_size);
+
+    return last > first ? last - first : 0;
+  }
+
+  bool
+  empty () const
+  {
+    return size () == 0;
+  }
+
+  bool
+  is_closed () const
+  {
+    return closed_.load ();
+  }
+
+private:
+  static constexpr size_type segment_size = 1024;
+
+  enum : unsigned char
+  {
+    slot_empty,
+    slot_writing,
+    slot_ready,
+    slot_skipped,
+  };
+
+  struct slot
+  {
+    std::atomic<unsigned char> state{ slot_empty };
+    alignas (T) unsigned char storage[sizeof (T)];
+
+    T *
+    get ()
+    {
+      return std::launder (reinterpret_cast<T *> (storage));
+    }
+  };
+
+  // Counts a push in progress for as long as it is in scope, including
+  // one that leaves by an exception, so a draining consumer never waits
+  // for a push that is gone.
+  struct pusher_guard
+  {
+    explicit pusher_guard (std::atomic<size_type> &count) : count (count)
+    {
+      count.fetch_add (1);
+    }
+
+    ~pusher_guard () { count.fetch_sub (1); }
+
+    pusher_guard (const pusher_guard &) = delete;
+    pusher_guard &operator= (const pusher_guard &) = delete;
+
+    std::atomic<size_type> &count;
+  };
+
+  struct segment
+  {
+    explicit segment (size_type id) : id (id) {}
+
+    const size_type id;
+    alignas (64) std::atomic<size_type> enq_idx{ 0 };
+    alignas (64) std::atomic<size_type> deq_idx{ 0 };
+    alignas (64) std::atomic<segment *> next{ nullptr };
+    slot slots[segment_size];
+  };
+
+  template <typename U>
+  void
+  enqueue (U &&elem)
+  {
+    for (;;)
+      {
+	segment *seg = tail_.load ();
+	size_type idx = seg->enq_idx.fetch_add (1);
+
+	if (idx < segment_size)
+	  {
+	    slot &s = seg->slots[idx];
+	    unsigned char expected = slot_empty;
+
+	    // Fails only if a consumer gave up on this slot; take another.
+	    if (s.state.compare_exchange_strong (expected, slot_writing,
+						 std::memory_order_acquire))
+	      {
+		// A consumer may already be waiting on this slot; if T's
+		// constructor throws, let it move past instead.
+		try
+		  {
+		    ::new (static_cast<void *> (s.storage))
+			T (std::forward<U> (elem));
+		  }
+		catch (...)
+		  {
+		    s.state.store (slot_skipped, std::memory_order_release);
+		    throw;
+		  }
+		s.state.store (slot_ready, std::memory_order_release);
+		return;
+	      }
+	    continue;
+	  }
+
+	segment *next = seg->next.load ();
+	if (!next)
+	  {
+	    segment *fresh = new segment (seg->id + 1);
+	    if (seg->next.compare_exchange_strong (next, fresh))
+	      next = fresh;
+	    else
+	      delete fresh;
+	  }
+	tail_.compare_exchange_strong (seg, next);
+      }
+  }
+
+  std::optional<T>
+  dequeue ()
+  {
+    epoch_guard guard;
+
+    for (;;)
+      {
+	segment *seg = head_.load ();
+	size_type deq = seg->deq_idx.load ();
+	size_type enq = seg->enq_idx.load ();
+
+	if (deq >= segment_size)
+	  {
+	    segment *next = seg->next.load ();
+	    if (!next)
+	      return std::nullopt;
+
+	    // Never let head_ pass tail_, or a producer could still reach the
+	    // segment we are about to retire.
+	    segment *expected = seg;
+	    tail_.compare_exchange_strong (expected, next);
+	    if (head_.compare_exchange_strong (seg, next))
+	      epoch_domain::global ().retire (seg);
+	    continue;
+	  }
+
+	if (deq >= enq)
+	  return std::nullopt;
+
+	size_type idx = seg->deq_idx.fetch_add (1);
+	if (idx >= segment_size)
+	  continue;
+
+	slot &s = seg->slots[idx];
+	unsigned char state = s.state.load (std::memory_order_acquire);
+
+	// The slot has been claimed by a producer that has not started
+	// writing yet. Give it a moment, then skip the slot so a stalled
+	// producer cannot hold consumers up; it will retry elsewhere.
+	for (int spins = 0; state == slot_empty && spins < 128; spins++)
+	  {
+	    relax ();
+	    state = s.state.load (std::memory_order_acquire);
+	  }
+	if (state == slot_empty
+	    && s.state.compare_exchange_strong (state, slot_skipped,
+						std::memory_order_acquire))
+	  continue;
+
+	while (state == slot_writing)
+	  {
+	    relax ();
+	    state = s.state.load (std::memory_order_acquire);
+	  }
+
+	// The producer's constructor threw.
+	if (state == slot_skipped)
+	  continue;
+
+	T *p = s.get ();
+	std::optional<T> elem (std::move (*p));
+	p->~T ();
+	return elem;
+      }
+  }
+
+  std::optional<T>
+  pop_until (const std::chrono::steady_clock::time_point *deadline)
+  {
+    for (;;)
+      {
+	for (int spins = 0; spins < 64; spins++)
+	  {
+	    if (auto elem = dequeue ())
+	      return elem;
+	    relax ();
+	  }
+
+	if (closed_.load ())
+	  {
+	    // Producers that passed the closed check before close () may
+	    // still be writing; their elements must be drained too.
+	    if (auto elem = dequeue ())
+	      return elem;
+	    if (pushers_.load () == 0)
+	      return dequeue ();
+	    std::this_thread::yield ();
+	    continue;
+	  }
+
+	std::unique_lock<std::mutex> lock (mutex_);
+	sleepers_.fetch_add (1);
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+
+	auto elem = dequeue ();
+	if (!elem && !closed_.load ())
+	  {
+	    size_type epoch = epoch_;
+	    auto woken = [this, epoch] ()
+	      { return epoch_ != epoch || closed_.load (); };
+
+	    if (deadline)
+	      cv_.wait_until (lock, *deadline, woken);
+	    else
+	      cv_.wait (lock, woken);
+	  }
+
+	sleepers_.fetch_sub (1);
+	lock.unlock ();
+
+	if (elem)
+	  return elem;
+	if (deadline && std::chrono::steady_clock::now () >= *deadline)
+	  return dequeue ();
+      }
+  }
+
+  void
+  wake (bool all)
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      epoch_++;
+    }
+    if (all)
+      cv_.notify_all ();
+    else
+      cv_.notify_one ();
+  }
+
+  static void
+  relax ()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause ();
+#elif defined(__aarch64__)
+    asm volatile ("yield");
+#endif
+  }
+
+private:
+  alignas (64) std::atomic<segment *> head_;
+  alignas (64) std::atomic<segment *> tail_;
+  alignas (64) std::atomic<size_type> pushers_;
+  std::atomic<bool> closed_;
+
+  alignas (64) std::atomic<size_type> sleepers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_type epoch_;
+};
+
+#endif // CONCURRENT_LOCK_FREE_QUEUE_H
@@ -0,0 +1,29 @@
+#ifndef CONCURRENT_PRIORITY_QUEUE_H
+#define CONCURRENT_PRIORITY_QUEUE_H
+
+#include <functional>
+#include <limits>
+
+#include "basic_blocking_queue.h"
+#include "d_ary_heap.h"
+
+// concurrent_blocking_queue ordered by Compare instead of arrival: pop ()
+// returns the greatest element, as std::priority_queue would.
+template <typename T, typename Compare = std::less<T>>
+class concurrent_priority_queue
+    : public basic_blocking_queue<T, d_ary_heap<T, Compare>>
+{
+  using base = basic_blocking_queue<T, d_ary_heap<T, Compare>>;
+
+public:
+  using size_type = typename base::size_type;
+
+  explicit concurrent_priority_queue (size_type capacity
+				      = std::numeric_limits<size_type>::max (),
+				      const Compare &comp = Compare ())
+      : base (capacity, 0, d_ary_heap<T, Compare> (comp))
+  {
+  }
+};
+
+#endif // CONCURRENT_PRIORITY_QUEUE_H
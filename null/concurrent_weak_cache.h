@@ -0,0 +1,148 @@
+#ifndef CONCURRENT_WEAK_CACHE_H
+#define CONCURRENT_WEAK_CACHE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "shared_ptr.h"
+#include "weak_ptr.h"
+
+// Interning map from K to values it does not keep alive: a value lives as
+// long as somebody outside the cache holds it, and the next lookup of its
+// key after that creates a new one. There is no capacity to tune.
+//
+// Keys are spread over independently locked shards. An expired entry
+// still pins its control block, and with make_shared_ptr the value's storage
+// too, so entries are dropped as soon as a probe finds them expired, and
+// a shard sweeps all of its entries whenever it has grown to twice the
+// number that were alive at its previous sweep; the sweep cost is spread
+// over the insertions that caused it.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class concurrent_weak_cache
+{
+public:
+  using key_type = K;
+  using value_type = shared_ptr<V>;
+  using size_type = size_t;
+
+  static constexpr size_type shard_count = 16;
+
+  concurrent_weak_cache () = default;
+
+  concurrent_weak_cache (const concurrent_weak_cache &) = delete;
+  concurrent_weak_cache &operator= (const concurrent_weak_cache &) = delete;
+
+  // Empty if key has no live value.
+  shared_ptr<V>
+  find (const K &key)
+  {
+    shard &s = shard_for (key);
+    std::lock_guard<std::mutex> lock (s.mutex);
+    return probe (s, key);
+  }
+
+  // Returns the live value for key, or the one make () returns, which is
+  // then stored. make () runs without the shard lock held, so when two
+  // threads miss on the same key at once both may call it, but only one
+  // result is kept and both callers get that one.
+  template <typename Factory>
+  shared_ptr<V>
+  get_or_create (const K &key, Factory &&make)
+  {
+    shard &s = shard_for (key);
+    {
+      std::lock_guard<std::mutex> lock (s.mutex);
+      if (shared_ptr<V> sp = probe (s, key))
+	return sp;
+    }
+
+    shared_ptr<V> created = make ();
+    if (!created)
+      return created;
+
+    std::lock_guard<std::mutex> lock (s.mutex);
+    if (shared_ptr<V> sp = probe (s, key))
+      return sp;
+
+    s.map.emplace (key, weak_ptr<V>{ created });
+    if (s.map.size () >= s.sweep_at)
+      sweep (s);
+    return created;
+  }
+
+  void
+  erase (const K &key)
+  {
+    shard &s = shard_for (key);
+    std::lock_guard<std::mutex> lock (s.mutex);
+    s.map.erase (key);
+  }
+
+  // Counts entries whose values may already have expired.
+  size_type
+  size () const
+  {
+    size_type n = 0;
+    for (const shard &s : shards_)
+      {
+	std::lock_guard<std::mutex> lock (s.mutex);
+	n += s.map.size ();
+      }
+    return n;
+  }
+
+private:
+  static constexpr size_type min_sweep = 16;
+
+  struct alignas (64) shard
+  {
+    mutable std::mutex mutex;
+    std::unordered_map<K, weak_ptr<V>, Hash> map;
+    size_type sweep_at = min_sweep;
+  };
+
+  shard &
+  shard_for (const K &key)
+  {
+    // Mix the hash so that shards do not simply follow its low bits,
+    // which the maps inside them use too.
+    size_t h = hash_ (key);
+    h ^= h >> 31;
+    h *= 0x9e3779b97f4a7c15ull;
+    return shards_[(h >> 32) % shard_count];
+  }
+
+  static shared_ptr<V>
+  probe (shard &s, const K &key)
+  {
+    auto it = s.map.find (key);
+    if (it == s.map.end ())
+      return {};
+
+    shared_ptr<V> sp = it->second.lock ();
+    if (!sp)
+      s.map.erase (it);
+    return sp;
+  }
+
+  static void
+  sweep (shard &s)
+  {
+    for (auto it = s.map.begin (); it != s.map.end ();)
+      if (it->second.expired ())
+	it = s.map.erase (it);
+      else
+	++it;
+
+    s.sweep_at = std::max (min_sweep, 2 * s.map.size ());
+  }
+
+  Hash hash_;
+  shard shards_[shard_count];
+};
+
+#endif // CONCURRENT_WEAK_CACHE_H
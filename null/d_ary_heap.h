@@ -0,0 +1,128 @@
+#ifndef D_ARY_HEAP_H
+#define D_ARY_HEAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Implicit heap with Arity children per node, ordered like
+// std::priority_queue: top () is the element no other element compares
+// greater than. The children of a node are contiguous, so a sift-down step
+// scans one or two cache lines instead of chasing log2 (n) of them, and the
+// tree is half as deep as a binary heap for Arity = 4.
+template <typename T, typename Compare = std::less<T>, size_t Arity = 4>
+class d_ary_heap
+{
+  static_assert (Arity >= 2, "A heap node needs at least two children.");
+
+public:
+  using value_type = T;
+  using size_type = size_t;
+
+  explicit d_ary_heap (const Compare &comp = Compare ()) : comp_ (comp) {}
+
+  bool
+  empty () const
+  {
+    return data_.empty ();
+  }
+
+  size_type
+  size () const
+  {
+    return data_.size ();
+  }
+
+  const T &
+  top () const
+  {
+    return data_.front ();
+  }
+
+  void
+  reserve (size_type n)
+  {
+    data_.reserve (n);
+  }
+
+  template <typename U>
+  void
+  push (U &&value)
+  {
+    data_.push_back (std::forward<U> (value));
+    sift_up (data_.size () - 1);
+  }
+
+  template <typename... Args>
+  void
+  emplace (Args &&...args)
+  {
+    data_.emplace_back (std::forward<Args> (args)...);
+    sift_up (data_.size () - 1);
+  }
+
+  T
+  pop ()
+  {
+    T top = std::move (data_.front ());
+    T last = std::move (data_.back ());
+    data_.pop_back ();
+
+    if (!data_.empty ())
+      sift_down (0, std::move (last));
+
+    return top;
+  }
+
+private:
+  // Both sifts move a hole instead of swapping, so each level costs one
+  // move rather than three.
+  void
+  sift_up (size_type i)
+  {
+    T value = std::move (data_[i]);
+    while (i > 0)
+      {
+	size_type parent = (i - 1) / Arity;
+	if (!comp_ (data_[parent], value))
+	  break;
+
+	data_[i] = std::move (data_[parent]);
+	i = parent;
+      }
+    data_[i] = std::move (value);
+  }
+
+  void
+  sift_down (size_type i, T value)
+  {
+    size_type n = data_.size ();
+    for (;;)
+      {
+	size_type first = i * Arity + 1;
+	if (first >= n)
+	  break;
+
+	size_type best = first;
+	size_type last = std::min (first + Arity, n);
+	for (size_type c = first + 1; c < last; c++)
+	  if (comp_ (data_[best], data_[c]))
+	    best = c;
+
+	if (!comp_ (value, data_[best]))
+	  break;
+
+	data_[i] = std::move (data_[best]);
+	i = best;
+      }
+    data_[i] = std::move (value);
+  }
+
+private:
+  std::vector<T> data_;
+  Compare comp_;
+};
+
+#endif // D_ARY_HEAP_H
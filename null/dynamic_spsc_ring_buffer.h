@@ -0,0 +1,286 @@
+#ifndef DYNAMIC_SPSC_RING_BUFFER_H
+#define DYNAMIC_SPSC_RING_BUFFER_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+enum class page_kind
+{
+  normal,
+  transparent_huge,
+  huge_2mb,
+  huge_1gb,
+};
+
+struct ring_buffer_options
+{
+  // Largest page size to try; smaller ones are tried in turn on failure.
+  page_kind pages = page_kind::normal;
+  // Touch every page up front so the first pass takes no page faults.
+  bool prefault = false;
+  // Pin the pages in memory with mlock (implies prefault).
+  bool lock = false;
+};
+
+template <typename T>
+class dynamic_spsc_ring_buffer
+{
+public:
+  using size_type = size_t;
+
+  explicit dynamic_spsc_ring_buffer (size_type capacity,
+				     const ring_buffer_options &options = {})
+      : head_ (0), tail_ (0), slots_ (capacity + 1), buffer_ (nullptr),
+	length_ (0), pages_ (page_kind::normal)
+  {
+    if (capacity == 0)
+      throw std::invalid_argument ("Ring buffer capacity must be positive.");
+    // One slot more than the capacity is mapped, and its size in bytes,
+    // rounded up to whatever pages end up backing it, must not wrap.
+    if (capacity > max_capacity ())
+      throw std::length_error ("Ring buffer capacity is too large.");
+
+    map (options);
+  }
+
+  ~dynamic_spsc_ring_buffer ()
+  {
+    size_type head = head_.load (std::memory_order_relaxed);
+    for (size_type i = tail_.load (std::memory_order_relaxed); i != head;
+	 i = next (i))
+      std::launder (buffer_ + i)->~T ();
+    ::munmap (buffer_, length_);
+  }
+
+  dynamic_spsc_ring_buffer (const dynamic_spsc_ring_buffer &) = delete;
+  dynamic_spsc_ring_buffer &operator= (const dynamic_spsc_ring_buffer &)
+      = delete;
+
+  template <typename U>
+  bool
+  push (U &&item)
+  {
+    size_type curr_head = head_.load (std::memory_order_relaxed);
+    size_type next_head = next (curr_head);
+
+    if (next_head == tail_.load (std::memory_order_acquire))
+      return false;
+
+    ::new (static_cast<void *> (buffer_ + curr_head))
+	T (std::forward<U> (item));
+    head_.store (next_head, std::memory_order_release);
+
+    return true;
+  }
+
+  bool
+  pop (T &elem)
+  {
+    size_type curr_tail = tail_.load (std::memory_order_relaxed);
+
+    if (curr_tail == head_.load (std::memory_order_acquire))
+      return false;
+
+    T *slot = std::launder (buffer_ + curr_tail);
+    elem = std::move (*slot);
+    slot->~T ();
+    tail_.store (next (curr_tail), std::memory_order_release);
+
+    return true;
+  }
+
+  size_type
+  size () const
+  {
+    size_type curr_head = head_.load (std::memory_order_relaxed);
+    size_type curr_tail = tail_.load (std::memory_order_relaxed);
+
+    if (curr_head >= curr_tail)
+      return curr_head - curr_tail;
+    else
+      return slots_ - (curr_tail - curr_head);
+  }
+
+  size_type
+  capacity () const
+  {
+    return slots_ - 1;
+  }
+
+  bool
+  is_full () const
+  {
+    return next (head_.load (std::memory_order_relaxed))
+	   == tail_.load (std::memory_order_relaxed);
+  }
+
+  bool
+  is_empty () const
+  {
+    return head_.load (std::memory_order_relaxed)
+	   == tail_.load (std::memory_order_relaxed);
+  }
+
+  // The page size the buffer actually ended up on after fallbacks.
+  page_kind
+  pages () const
+  {
+    return pages_;
+  }
+
+private:
+  static constexpr size_type huge_2mb = size_type (1) << 21;
+  static constexpr size_type huge_1gb = size_type (1) << 30;
+
+  // Leaves room for the largest rounding map () can apply: up to a 1 GB
+  // page, or up to a 2 MB page plus the extra one map_transparent () maps
+  // to align it.
+  static constexpr size_type
+  max_capacity ()
+  {
+    return (std::numeric_limits<size_type>::max () - huge_1gb) / sizeof (T)
+	   - 1;
+  }
+
+  // A compare is cheaper than the division a runtime modulus would cost.
+  size_type
+  next (size_type index) const
+  {
+    return ++index == slots_ ? 0 : index;
+  }
+
+  static size_type
+  round_up (size_type n, size_type align)
+  {
+    return (n + align - 1) / align * align;
+  }
+
+  void
+  map (const ring_buffer_options &options)
+  {
+    size_type bytes = slots_ * sizeof (T);
+    bool prefault = options.prefault || options.lock;
+    int populate = prefault ? MAP_POPULATE : 0;
+
+    if (options.pages == page_kind::huge_1gb
+	&& map_hugetlb (round_up (bytes, huge_1gb), MAP_HUGE_1GB | populate))
+      pages_ = page_kind::huge_1gb;
+    else if ((options.pages == page_kind::huge_1gb
+	      || options.pages == page_kind::huge_2mb)
+	     && map_hugetlb (round_up (bytes, huge_2mb),
+			     MAP_HUGE_2MB | populate))
+      pages_ = page_kind::huge_2mb;
+    else if (options.pages != page_kind::normal)
+      map_transparent (bytes, prefault);
+    else
+      map_normal (bytes, prefault);
+
+    if (options.lock && ::mlock (buffer_, length_) != 0)
+      {
+	int error = errno;
+	::munmap (buffer_, length_);
+	throw std::system_error (error, std::generic_category (), "mlock");
+      }
+  }
+
+  bool
+  map_hugetlb (size_type length, int flags)
+  {
+    flags |= MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+    void *p = ::mmap (nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED)
+      return false;
+
+    buffer_ = static_cast<T *> (p);
+    length_ = length;
+    return true;
+  }
+
+  // Transparent huge pages only back 2 MB aligned extents, so over-map by
+  // one huge page and trim the unaligned head and tail.
+  void
+  map_transparent (size_type bytes, bool prefault)
+  {
+    size_type length = round_up (bytes, huge_2mb);
+    void *p = ::mmap (nullptr, length + huge_2mb, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      throw std::bad_alloc ();
+
+    char *raw = static_cast<char *> (p);
+    char *aligned = reinterpret_cast<char *> (
+	round_up (reinterpret_cast<size_type> (raw), huge_2mb));
+
+    if (aligned != raw)
+      ::munmap (raw, aligned - raw);
+    ::munmap (aligned + length, raw + huge_2mb - aligned);
+
+    buffer_ = reinterpret_cast<T *> (aligned);
+    length_ = length;
+    pages_ = ::madvise (aligned, length, MADV_HUGEPAGE) == 0
+		 ? page_kind::transparent_huge
+		 : page_kind::normal;
+
+    if (prefault)
+      touch ();
+  }
+
+  void
+  map_normal (size_type bytes, bool prefault)
+  {
+    size_type page = static_cast<size_type> (::sysconf (_SC_PAGESIZE));
+    size_type length = round_up (bytes, page);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | (prefault ? MAP_POPULATE : 0);
+    void *p = ::mmap (nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED)
+      throw std::bad_alloc ();
+
+    buffer_ = static_cast<T *> (p);
+    length_ = length;
+  }
+
+  // Write one byte per base page so the kernel backs the whole extent now
+  // rather than on the hot path, whether or not THP kicked in.
+  void
+  touch ()
+  {
+    size_type stride = static_cast<size_type> (::sysconf (_SC_PAGESIZE));
+    volatile char *p = reinterpret_cast<char *> (buffer_);
+    for (size_type off = 0; off < length_; off += stride)
+      p[off] = 0;
+  }
+
+private:
+  std::atomic<size_type> head_;
+  unsigned char pad_[64 - sizeof (head_)];
+  std::atomic<size_type> tail_;
+  unsigned char pad2_[64 - sizeof (tail_)];
+
+  size_type slots_;
+  T *buffer_;
+  size_type length_;
+  page_kind pages_;
+};
+
+#endif // DYNAMIC_SPSC_RING_BUFFER_H
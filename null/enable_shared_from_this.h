@@ -0,0 +1,78 @@
+#ifndef ENABLE_SHARED_FROM_THIS_H
+#define ENABLE_SHARED_FROM_THIS_H
+
+#include <exception>
+
+#include "shared_ptr.h"
+#include "weak_ptr.h"
+
+struct bad_weak_ptr : std::exception
+{
+  const char *
+  what () const noexcept override
+  {
+    return "bad_weak_ptr";
+  }
+};
+
+// Base for objects that need an owner of themselves, e.g. to keep a session
+// alive across its own asynchronous handlers. The first shared_ptr with the
+// same Policy to take ownership of the object, through its constructor,
+// make_shared_ptr or allocate_shared_ptr, fills in the weak_ptr kept here.
+template <class T, class Policy>
+class enable_shared_from_this
+{
+  template <class, class>
+  friend class shared_ptr;
+
+public:
+  // Throws bad_weak_ptr unless a shared_ptr owns the object.
+  shared_ptr<T, Policy>
+  shared_from_this ()
+  {
+    shared_ptr<T, Policy> sp = weak_this_.lock ();
+    if (!sp)
+      throw bad_weak_ptr{};
+    return sp;
+  }
+
+  shared_ptr<const T, Policy>
+  shared_from_this () const
+  {
+    shared_ptr<const T, Policy> sp = weak_this_.lock ();
+    if (!sp)
+      throw bad_weak_ptr{};
+    return sp;
+  }
+
+  weak_ptr<T, Policy>
+  weak_from_this () noexcept
+  {
+    return weak_this_;
+  }
+
+  weak_ptr<const T, Policy>
+  weak_from_this () const noexcept
+  {
+    return weak_this_;
+  }
+
+protected:
+  constexpr enable_shared_from_this () noexcept = default;
+
+  // Copies get an owner of their own.
+  enable_shared_from_this (const enable_shared_from_this &) noexcept {}
+
+  enable_shared_from_this &
+  operator= (const enable_shared_from_this &) noexcept
+  {
+    return *this;
+  }
+
+  ~enable_shared_from_this () = default;
+
+private:
+  mutable weak_ptr<T, Policy> weak_this_;
+};
+
+#endif // ENABLE_SHARED_FROM_THIS_H
@@ -0,0 +1,247 @@
+#ifndef INTRUSIVE_PTR_H
+#define INTRUSIVE_PTR_H
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "ref_count_policy.h"
+
+// Base that keeps the reference count inside Derived. When the count drops
+// to zero, Derived::intrusive_release (p) is called; the default deletes p,
+// and Derived can hide it with its own static intrusive_release, e.g. one
+// that returns the object to a pool. Copying an object does not copy its
+// count.
+template <class Derived, class Policy = atomic_policy>
+class intrusive_ref_counter
+{
+public:
+  typedef Policy policy_type;
+
+  intrusive_ref_counter () noexcept : count_{ 0 } {}
+  intrusive_ref_counter (const intrusive_ref_counter &) noexcept : count_{ 0 }
+  {
+  }
+
+  intrusive_ref_counter &
+  operator= (const intrusive_ref_counter &) noexcept
+  {
+    return *this;
+  }
+
+  long
+  use_count () const noexcept
+  {
+    return count_.load ();
+  }
+
+  static void
+  intrusive_release (Derived *p)
+  {
+    delete p;
+  }
+
+  friend void
+  intrusive_ptr_add_ref (const intrusive_ref_counter *p) noexcept
+  {
+    p->count_.increment ();
+  }
+
+  friend void
+  intrusive_ptr_release (const intrusive_ref_counter *p)
+  {
+    if (p->count_.decrement ())
+      Derived::intrusive_release (
+	  const_cast<Derived *> (static_cast<const Derived *> (p)));
+  }
+
+protected:
+  ~intrusive_ref_counter () = default;
+
+private:
+  mutable typename Policy::counter count_;
+};
+
+// One-word owning pointer to an object that counts its own references
+// through intrusive_ptr_add_ref (p) and intrusive_ptr_release (p), found by
+// argument-dependent lookup; intrusive_ref_counter provides both. Because
+// the count travels with the object, a raw pointer can always be turned
+// back into an owner: detach () hands a reference to C code as a plain
+// pointer, and intrusive_ptr (p, false) takes it back.
+template <class T>
+class intrusive_ptr
+{
+  template <class>
+  friend class intrusive_ptr;
+
+public:
+  typedef T *pointer;
+  typedef T element_type;
+
+  constexpr intrusive_ptr () noexcept : px_{} {}
+  constexpr intrusive_ptr (std::nullptr_t) noexcept : px_{} {}
+
+  // With add_ref false, adopts a reference the caller already owns.
+  intrusive_ptr (T *p, bool add_ref = true) : px_{ p }
+  {
+    if (px_ && add_ref)
+      intrusive_ptr_add_ref (px_);
+  }
+
+  ~intrusive_ptr ()
+  {
+    if (px_)
+      intrusive_ptr_release (px_);
+  }
+
+  intrusive_ptr (const intrusive_ptr &other) : px_{ other.px_ }
+  {
+    if (px_)
+      intrusive_ptr_add_ref (px_);
+  }
+
+  intrusive_ptr &
+  operator= (const intrusive_ptr &other)
+  {
+    intrusive_ptr t{ other };
+    swap (*this, t);
+    return *this;
+  }
+
+  template <class U, typename std::enable_if<
+			 std::is_convertible<U *, T *>::value, int>::type
+		     = 0>
+  intrusive_ptr (const intrusive_ptr<U> &other) : px_{ other.px_ }
+  {
+    if (px_)
+      intrusive_ptr_add_ref (px_);
+  }
+
+  template <class U, typename std::enable_if<
+			 std::is_convertible<U *, T *>::value, int>::type
+		     = 0>
+  intrusive_ptr &
+  operator= (const intrusive_ptr<U> &other)
+  {
+    intrusive_ptr t{ other };
+    swap (*this, t);
+    return *this;
+  }
+
+  intrusive_ptr (intrusive_ptr &&other) noexcept : px_{ other.px_ }
+  {
+    other.px_ = nullptr;
+  }
+
+  intrusive_ptr &
+  operator= (intrusive_ptr &&other) noexcept
+  {
+    intrusive_ptr t{ std::move (other) };
+    swap (*this, t);
+    return *this;
+  }
+
+  template <class U, typename std::enable_if<
+			 std::is_convertible<U *, T *>::value, int>::type
+		     = 0>
+  intrusive_ptr (intrusive_ptr<U> &&other) noexcept : px_{ other.px_ }
+  {
+    other.px_ = nullptr;
+  }
+
+  template <class U, typename std::enable_if<
+			 std::is_convertible<U *, T *>::value, int>::type
+		     = 0>
+  intrusive_ptr &
+  operator= (intrusive_ptr<U> &&other) noexcept
+  {
+    intrusive_ptr t{ std::move (other) };
+    swap (*this, t);
+    return *this;
+  }
+
+  T &
+  operator* () const noexcept
+  {
+    return *px_;
+  }
+
+  T *
+  operator->() const noexcept
+  {
+    return px_;
+  }
+
+  explicit
+  operator bool () const noexcept
+  {
+    return px_;
+  }
+
+  T *
+  get () const noexcept
+  {
+    return px_;
+  }
+
+  // Gives up ownership without releasing the reference.
+  T *
+  detach () noexcept
+  {
+    T *p = px_;
+    px_ = nullptr;
+    return p;
+  }
+
+  void
+  reset (T *p = nullptr, bool add_ref = true)
+  {
+    intrusive_ptr t{ p, add_ref };
+    swap (*this, t);
+  }
+
+  friend void
+  swap (intrusive_ptr &a, intrusive_ptr &b) noexcept
+  {
+    using std::swap;
+    swap (a.px_, b.px_);
+  }
+
+  template <class U>
+  friend bool
+  operator== (const intrusive_ptr &a, const intrusive_ptr<U> &b) noexcept
+  {
+    return a.get () == b.get ();
+  }
+
+  template <class U>
+  friend bool
+  operator!= (const intrusive_ptr &a, const intrusive_ptr<U> &b) noexcept
+  {
+    return a.get () != b.get ();
+  }
+
+  friend bool
+  operator== (const intrusive_ptr &a, std::nullptr_t) noexcept
+  {
+    return !a;
+  }
+
+  friend bool
+  operator!= (const intrusive_ptr &a, std::nullptr_t) noexcept
+  {
+    return static_cast<bool> (a);
+  }
+
+private:
+  pointer px_;
+};
+
+template <class T, class... Args>
+intrusive_ptr<T>
+make_intrusive (Args &&...args)
+{
+  return intrusive_ptr<T>{ new T (std::forward<Args> (args)...) };
+}
+
+#endif // INTRUSIVE_PTR_H
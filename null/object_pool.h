@@ -0,0 +1,241 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "unique_ptr.h"
+
+template <class T, size_t MaxIdle = 4096, size_t Batch = 64>
+class object_pool;
+
+// Stateless, so unique_ptr<T, pool_deleter<T>> stays one pointer wide.
+template <class T, size_t MaxIdle = 4096, size_t Batch = 64>
+struct pool_deleter
+{
+  void
+  operator() (T *p) const noexcept
+  {
+    object_pool<T, MaxIdle, Batch>::release (p);
+  }
+};
+
+// Recycles whole objects of type T instead of destroying them: releasing
+// an object keeps it constructed, so a buffer or parser comes back with
+// the memory it had already grown, and the next acquire () hands it out
+// again as it was left. Callers reset whatever state matters to them.
+//
+// Each thread caches two magazines of up to Batch idle objects and swaps
+// whole magazines with a shared depot, under a lock, only when both are
+// empty or both full, so the lock is taken at most once per Batch
+// operations and a steady state allocates nothing. New objects are
+// default-constructed when the depot has none either. The depot keeps at
+// most MaxIdle objects; a magazine handed in beyond that is destroyed, so
+// a burst does not leave its high-water mark behind.
+template <class T, size_t MaxIdle, size_t Batch>
+class object_pool
+{
+public:
+  typedef unique_ptr<T, pool_deleter<T, MaxIdle, Batch>> pointer;
+
+  static constexpr size_t batch = Batch;
+  static constexpr size_t max_idle = MaxIdle;
+
+  static_assert (Batch > 0, "A magazine must hold something.");
+
+  static pointer
+  acquire ()
+  {
+    static_assert (sizeof (pointer) == sizeof (T *),
+		   "pool_deleter must not make the pointer wider.");
+
+    cache &c = local ();
+    if (c.loaded.empty ())
+      {
+	if (c.previous.empty () && !refill (c))
+	  return pointer{ new T };
+	if (c.loaded.empty ())
+	  c.loaded.swap (c.previous);
+      }
+
+    T *p = c.loaded.back ();
+    c.loaded.pop_back ();
+    return pointer{ p };
+  }
+
+  // Constructs at least n idle objects up front, or as many as the depot
+  // keeps, so a burst does not pay for them.
+  static void
+  reserve (size_t n)
+  {
+    depot &d = global ();
+    for (size_t made = 0; made < n; made += batch)
+      {
+	magazine m;
+	try
+	  {
+	    m.reserve (batch);
+	    for (size_t i = 0; i < batch; i++)
+	      m.push_back (new T);
+
+	    std::lock_guard<std::mutex> lock (d.mutex);
+	    if (d.full.size () >= max_magazines)
+	      {
+		discard (m);
+		return;
+	      }
+	    d.full.push_back (std::move (m));
+	  }
+	catch (...)
+	  {
+	    discard (m);
+	    throw;
+	  }
+      }
+  }
+
+private:
+  friend struct pool_deleter<T, MaxIdle, Batch>;
+
+  static constexpr size_t max_magazines = MaxIdle / Batch;
+
+  typedef std::vector<T *> magazine;
+
+  struct depot
+  {
+    std::mutex mutex;
+    std::vector<magazine> full;
+    std::vector<magazine> empty;
+
+    ~depot ()
+    {
+      for (auto &m : full)
+	for (T *p : m)
+	  delete p;
+    }
+  };
+
+  struct cache
+  {
+    magazine loaded;
+    magazine previous;
+
+    ~cache ()
+    {
+      depot &d = global ();
+      std::lock_guard<std::mutex> lock (d.mutex);
+      for (magazine *m : { &loaded, &previous })
+	if (!m->empty ())
+	  {
+	    try
+	      {
+		if (d.full.size () >= max_magazines)
+		  discard (*m);
+		else
+		  d.full.push_back (std::move (*m));
+	      }
+	    catch (...)
+	      {
+		discard (*m);
+	      }
+	  }
+    }
+  };
+
+  // Keeping an object may need memory for a magazine or the depot; when
+  // there is none, the object is destroyed instead.
+  static void
+  release (T *p) noexcept
+  {
+    try
+      {
+	cache &c = local ();
+	if (c.loaded.size () == batch)
+	  {
+	    if (c.previous.size () == batch)
+	      swap_out (c);
+	    else
+	      c.loaded.swap (c.previous);
+	  }
+	c.loaded.push_back (p);
+      }
+    catch (...)
+      {
+	delete p;
+      }
+  }
+
+  static void
+  discard (magazine &m) noexcept
+  {
+    for (T *p : m)
+      delete p;
+    m.clear ();
+  }
+
+  static depot &
+  global ()
+  {
+    static depot d;
+    return d;
+  }
+
+  static cache &
+  local ()
+  {
+    thread_local cache c;
+    return c;
+  }
+
+  // Both magazines are empty: trade one for a full one.
+  static bool
+  refill (cache &c)
+  {
+    depot &d = global ();
+    std::lock_guard<std::mutex> lock (d.mutex);
+    if (d.full.empty ())
+      return false;
+
+    // The empty magazine goes in first, so that a failure to make room for
+    // it leaves the depot as it was.
+    d.empty.push_back (std::move (c.previous));
+    c.previous.swap (d.full.back ());
+    d.full.pop_back ();
+    return true;
+  }
+
+  // Both magazines are full: hand one in and load an empty one. A full
+  // depot has no use for it, so its objects are destroyed and the magazine
+  // itself reloaded.
+  static void
+  swap_out (cache &c)
+  {
+    depot &d = global ();
+    std::unique_lock<std::mutex> lock (d.mutex);
+    if (d.full.size () >= max_magazines)
+      {
+	lock.unlock ();
+	discard (c.previous);
+	c.previous.swap (c.loaded);
+	return;
+      }
+
+    d.full.push_back (std::move (c.previous));
+    c.previous.swap (c.loaded);
+
+    if (d.empty.empty ())
+      {
+	c.loaded = magazine{};
+	c.loaded.reserve (batch);
+      }
+    else
+      {
+	c.loaded.swap (d.empty.back ());
+	d.empty.pop_back ();
+      }
+  }
+};
+
+#endif // OBJECT_POOL_H
@@ -0,0 +1,182 @@
+#ifndef POOL_ALLOCATOR_H
+#define POOL_ALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Free lists of Size-byte blocks. Each thread allocates from and frees to
+// its own cache without locking; caches trade whole batches with a shared
+// depot, under a lock, only when they run dry or grow past two batches, so
+// a block freed on another thread than the one that allocated it just
+// migrates. Memory goes back to the system only at exit.
+template <size_t Size, size_t Align>
+class fixed_size_pool
+{
+public:
+  static constexpr size_t batch = 64;
+
+  static void *
+  allocate ()
+  {
+    cache &c = local ();
+    if (!c.head)
+      refill (c);
+
+    node *n = c.head;
+    c.head = n->next;
+    c.count--;
+    return n;
+  }
+
+  static void
+  deallocate (void *p) noexcept
+  {
+    cache &c = local ();
+    node *n = static_cast<node *> (p);
+    n->next = c.head;
+    c.head = n;
+
+    if (++c.count > 2 * batch)
+      flush (c, batch);
+  }
+
+private:
+  union node
+  {
+    node *next;
+    alignas (Align) unsigned char storage[Size];
+  };
+
+  struct depot
+  {
+    std::mutex mutex;
+    std::vector<std::pair<node *, size_t>> chains;
+    std::vector<std::unique_ptr<node[]>> chunks;
+  };
+
+  struct cache
+  {
+    node *head = nullptr;
+    size_t count = 0;
+
+    ~cache () { flush (*this, count); }
+  };
+
+  static depot &
+  global ()
+  {
+    static depot d;
+    return d;
+  }
+
+  static cache &
+  local ()
+  {
+    thread_local cache c;
+    return c;
+  }
+
+  static void
+  refill (cache &c)
+  {
+    depot &d = global ();
+    {
+      std::lock_guard<std::mutex> lock (d.mutex);
+      if (!d.chains.empty ())
+	{
+	  c.head = d.chains.back ().first;
+	  c.count = d.chains.back ().second;
+	  d.chains.pop_back ();
+	  return;
+	}
+    }
+
+    std::unique_ptr<node[]> chunk (new node[batch]);
+    for (size_t i = 0; i + 1 < batch; i++)
+      chunk[i].next = &chunk[i + 1];
+    chunk[batch - 1].next = nullptr;
+
+    node *first = chunk.get ();
+    {
+      std::lock_guard<std::mutex> lock (d.mutex);
+      d.chunks.push_back (std::move (chunk));
+    }
+
+    c.head = first;
+    c.count = batch;
+  }
+
+  static void
+  flush (cache &c, size_t n)
+  {
+    if (n == 0)
+      return;
+
+    node *chain = c.head;
+    node *last = chain;
+    for (size_t i = 1; i < n; i++)
+      last = last->next;
+
+    c.head = last->next;
+    c.count -= n;
+    last->next = nullptr;
+
+    depot &d = global ();
+    std::lock_guard<std::mutex> lock (d.mutex);
+    d.chains.emplace_back (chain, n);
+  }
+};
+
+// Stateless allocator over fixed_size_pool for single objects, which is
+// all node-based containers and allocate_shared_ptr ever ask for; anything
+// else goes to std::allocator.
+template <class T>
+class pool_allocator
+{
+public:
+  typedef T value_type;
+
+  pool_allocator () noexcept = default;
+
+  template <class U>
+  pool_allocator (const pool_allocator<U> &) noexcept
+  {
+  }
+
+  T *
+  allocate (size_t n)
+  {
+    if (n == 1)
+      return static_cast<T *> (
+	  fixed_size_pool<sizeof (T), alignof (T)>::allocate ());
+    return std::allocator<T> ().allocate (n);
+  }
+
+  void
+  deallocate (T *p, size_t n) noexcept
+  {
+    if (n == 1)
+      fixed_size_pool<sizeof (T), alignof (T)>::deallocate (p);
+    else
+      std::allocator<T> ().deallocate (p, n);
+  }
+
+  template <class U>
+  friend bool
+  operator== (const pool_allocator &, const pool_allocator<U> &) noexcept
+  {
+    return true;
+  }
+
+  template <class U>
+  friend bool
+  operator!= (const pool_allocator &, const pool_allocator<U> &) noexcept
+  {
+    return false;
+  }
+};
+
+#endif // POOL_ALLOCATOR_H
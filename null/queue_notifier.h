@@ -0,0 +1,79 @@
+#ifndef QUEUE_NOTIFIER_H
+#define QUEUE_NOTIFIER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Event counter shared between any number of queues and one waiter. A
+// waiter reads epoch (), checks whatever it is interested in, and then
+// waits for the epoch to move; a notify () that lands anywhere after the
+// read is never lost. Queues call notify () under their own lock, so the
+// lock order is always queue, then notifier.
+class queue_notifier
+{
+public:
+  queue_notifier () : epoch_ (0), waiters_ (0) {}
+
+  queue_notifier (const queue_notifier &) = delete;
+  queue_notifier &operator= (const queue_notifier &) = delete;
+
+  void
+  notify ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      ++epoch_;
+      if (waiters_ == 0)
+	return;
+    }
+    cv_.notify_all ();
+  }
+
+  uint64_t
+  epoch () const
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return epoch_;
+  }
+
+  void
+  wait (uint64_t epoch)
+  {
+    std::unique_lock<std::mutex> lock (mutex_);
+    while (epoch_ == epoch)
+      {
+	++waiters_;
+	cv_.wait (lock);
+	--waiters_;
+      }
+  }
+
+  // Returns false if the deadline passed without a notification.
+  template <typename Clock, typename Duration>
+  bool
+  wait_until (uint64_t epoch,
+	      const std::chrono::time_point<Clock, Duration> &deadline)
+  {
+    std::unique_lock<std::mutex> lock (mutex_);
+    while (epoch_ == epoch)
+      {
+	++waiters_;
+	std::cv_status status = cv_.wait_until (lock, deadline);
+	--waiters_;
+
+	if (status == std::cv_status::timeout)
+	  return epoch_ != epoch;
+      }
+    return true;
+  }
+
+private:
+  mutable std::mutex mutex_;
+  uint64_t epoch_;
+  size_t waiters_;
+  std::condition_variable cv_;
+};
+
+#endif // QUEUE_NOTIFIER_H
@@ -0,0 +1,150 @@
+#ifndef QUEUE_SELECTOR_H
+#define QUEUE_SELECTOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "queue_notifier.h"
+
+// Blocks on several queues at once. wait () returns the id of a queue that
+// is non-empty or closed, checking higher priorities first and rotating
+// among queues of equal priority so none of them starves the others. The
+// element may still be taken by another consumer before the caller gets to
+// it, so pop with the non-waiting try_pop () and wait again if it comes
+// back empty; remove a queue once it is closed and drained.
+//
+// Queues must outlive their registration. One thread at a time may wait on
+// a selector.
+class queue_selector
+{
+public:
+  using size_type = size_t;
+
+  queue_selector () : next_id_ (0), last_ (0) {}
+
+  ~queue_selector ()
+  {
+    for (auto &s : sources_)
+      s.detach ();
+  }
+
+  queue_selector (const queue_selector &) = delete;
+  queue_selector &operator= (const queue_selector &) = delete;
+
+  template <typename Queue>
+  size_type
+  add (Queue &q, int priority = 0)
+  {
+    source s;
+    s.id = next_id_++;
+    s.priority = priority;
+    s.ready = [&q] () { return !q.empty () || q.is_closed (); };
+    s.detach = [this, &q] () { q.detach (notifier_); };
+
+    auto pos = std::find_if (sources_.begin (), sources_.end (),
+			     [priority] (const source &other)
+			       { return other.priority < priority; });
+    sources_.insert (pos, std::move (s));
+
+    q.attach (notifier_);
+    return next_id_ - 1;
+  }
+
+  void
+  remove (size_type id)
+  {
+    auto pos = std::find_if (sources_.begin (), sources_.end (),
+			     [id] (const source &s) { return s.id == id; });
+    if (pos == sources_.end ())
+      return;
+
+    pos->detach ();
+    sources_.erase (pos);
+  }
+
+  // Returns nothing only if no queue is registered.
+  std::optional<size_type>
+  wait ()
+  {
+    for (;;)
+      {
+	uint64_t epoch = notifier_.epoch ();
+	if (sources_.empty ())
+	  return std::nullopt;
+	if (auto id = find_ready ())
+	  return id;
+
+	notifier_.wait (epoch);
+      }
+  }
+
+  // Returns nothing if no queue became ready in time, or at once if no
+  // queue is registered.
+  template <typename Duration>
+  std::optional<size_type>
+  wait_for (const Duration &timeout)
+  {
+    auto deadline = std::chrono::steady_clock::now () + timeout;
+    for (;;)
+      {
+	uint64_t epoch = notifier_.epoch ();
+	if (sources_.empty ())
+	  return std::nullopt;
+	if (auto id = find_ready ())
+	  return id;
+
+	if (!notifier_.wait_until (epoch, deadline))
+	  return std::nullopt;
+      }
+  }
+
+private:
+  struct source
+  {
+    size_type id;
+    int priority;
+    std::function<bool ()> ready;
+    std::function<void ()> detach;
+  };
+
+  // sources_ is ordered by descending priority, so each priority is a
+  // contiguous run; within a run, the scan starts after the last winner.
+  std::optional<size_type>
+  find_ready ()
+  {
+    size_type n = sources_.size ();
+    for (size_type begin = 0, end; begin < n; begin = end)
+      {
+	end = begin + 1;
+	while (end < n && sources_[end].priority == sources_[begin].priority)
+	  end++;
+
+	size_type run = end - begin;
+	size_type start = 0;
+	if (last_ >= begin && last_ < end)
+	  start = last_ + 1 - begin;
+	for (size_type i = 0; i < run; i++)
+	  {
+	    size_type k = begin + (start + i) % run;
+	    if (sources_[k].ready ())
+	      {
+		last_ = k;
+		return sources_[k].id;
+	      }
+	  }
+      }
+    return std::nullopt;
+  }
+
+private:
+  queue_notifier notifier_;
+  std::vector<source> sources_;
+  size_type next_id_;
+  size_type last_;
+};
+
+#endif // QUEUE_SELECTOR_H
@@ -0,0 +1,469 @@
+#ifndef RECLAMATION_H
+#define RECLAMATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Safe memory reclamation for lock-free structures: a node unlinked by one
+// thread may still be read by others, so instead of deleting it the
+// remover retires it, and it is reclaimed once no reader can hold it.
+//
+// Two schemes share the same per-thread bookkeeping. Hazard pointers cost
+// readers a store and a fence per protected pointer but bound the garbage:
+// a thread never holds more than max (64, 2 * H) retired nodes, H being
+// the number of hazard slots of all threads, however slow the readers are.
+// Epochs cost readers one store and fence per critical section of any
+// length, but a thread that stalls inside one holds back all reclamation
+// until it leaves.
+//
+// Each thread retires into its own list and only scans when the list has
+// grown by a batch, so the cost of a scan is spread over many retires. A
+// thread's record, with whatever it has not managed to reclaim, is handed
+// to the next thread that starts using the scheme when it exits.
+
+struct retired_ptr
+{
+  void *p;
+  void (*reclaim) (void *);
+};
+
+template <class T>
+void
+delete_retired (void *p)
+{
+  delete static_cast<T *> (p);
+}
+
+// Records are never freed while the program runs, so readers may walk the
+// list without any protection of their own.
+template <class Record>
+class record_registry
+{
+public:
+  record_registry () : head_{ nullptr }, size_{ 0 } {}
+
+  ~record_registry ()
+  {
+    for (Record *r = head_.load (); r;)
+      {
+	Record *next = r->next;
+	delete r;
+	r = next;
+      }
+  }
+
+  record_registry (const record_registry &) = delete;
+  record_registry &operator= (const record_registry &) = delete;
+
+  Record *
+  acquire ()
+  {
+    for (Record *r = head_.load (std::memory_order_acquire); r; r = r->next)
+      if (!r->in_use.load (std::memory_order_relaxed)
+	  && !r->in_use.exchange (true, std::memory_order_acquire))
+	return r;
+
+    Record *r = new Record;
+    r->in_use.store (true, std::memory_order_relaxed);
+    r->next = head_.load (std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak (r->next, r,
+					 std::memory_order_release,
+					 std::memory_order_relaxed))
+      ;
+    size_.fetch_add (1, std::memory_order_relaxed);
+    return r;
+  }
+
+  void
+  release (Record *r) noexcept
+  {
+    r->in_use.store (false, std::memory_order_release);
+  }
+
+  Record *
+  head () const noexcept
+  {
+    return head_.load (std::memory_order_acquire);
+  }
+
+  size_t
+  size () const noexcept
+  {
+    return size_.load (std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<Record *> head_;
+  std::atomic<size_t> size_;
+};
+
+class hazard_pointer;
+
+class hazard_domain
+{
+  friend class hazard_pointer;
+
+public:
+  static constexpr unsigned slots_per_thread = 8;
+  static constexpr size_t batch = 64;
+
+  static hazard_domain &
+  global ()
+  {
+    static hazard_domain d;
+    return d;
+  }
+
+  // p must already be unreachable for readers that start from now on.
+  void
+  retire (void *p, void (*reclaim) (void *))
+  {
+    record &r = local ();
+    r.retired.push_back (retired_ptr{ p, reclaim });
+    if (r.retired.size () >= threshold ())
+      scan (r);
+  }
+
+  template <class T>
+  void
+  retire (T *p)
+  {
+    retire (p, &delete_retired<T>);
+  }
+
+  ~hazard_domain ()
+  {
+    for (record *r = records_.head (); r; r = r->next)
+      for (const retired_ptr &rp : r->retired)
+	rp.reclaim (rp.p);
+  }
+
+private:
+  struct record
+  {
+    std::atomic<const void *> hazards[slots_per_thread] = {};
+    unsigned free_slots = (1u << slots_per_thread) - 1;
+    std::vector<retired_ptr> retired;
+    std::vector<const void *> scratch;
+    std::atomic<bool> in_use{ false };
+    record *next = nullptr;
+  };
+
+  class owner
+  {
+  public:
+    explicit owner (hazard_domain &d) : d_{ d }, r_{ d.records_.acquire () }
+    {
+    }
+
+    ~owner ()
+    {
+      d_.scan (*r_);
+      d_.records_.release (r_);
+    }
+
+    record &
+    get () const noexcept
+    {
+      return *r_;
+    }
+
+  private:
+    hazard_domain &d_;
+    record *r_;
+  };
+
+  hazard_domain () = default;
+
+  record &
+  local ()
+  {
+    thread_local owner o{ *this };
+    return o.get ();
+  }
+
+  size_t
+  threshold () const noexcept
+  {
+    return std::max (batch, 2 * slots_per_thread * records_.size ());
+  }
+
+  // Reclaims every node of r that no hazard slot points to. Reclaiming
+  // may retire further nodes, so the list is detached first.
+  void
+  scan (record &r)
+  {
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+
+    r.scratch.clear ();
+    for (record *o = records_.head (); o; o = o->next)
+      for (const auto &h : o->hazards)
+	if (const void *p = h.load (std::memory_order_acquire))
+	  r.scratch.push_back (p);
+    std::sort (r.scratch.begin (), r.scratch.end ());
+
+    std::vector<retired_ptr> pending;
+    pending.swap (r.retired);
+    auto reclaimable = std::partition (
+	pending.begin (), pending.end (),
+	[&r] (const retired_ptr &rp)
+	  {
+	    return std::binary_search (r.scratch.begin (), r.scratch.end (),
+				       static_cast<const void *> (rp.p));
+	  });
+
+    r.retired.insert (r.retired.end (), pending.begin (), reclaimable);
+    for (auto it = reclaimable; it != pending.end (); ++it)
+      it->reclaim (it->p);
+  }
+
+  record_registry<record> records_;
+};
+
+// One hazard slot of the calling thread, owned for the lifetime of the
+// object, which must not leave that thread. A thread can hold at most
+// hazard_domain::slots_per_thread at a time.
+class hazard_pointer
+{
+public:
+  hazard_pointer () : r_{ &hazard_domain::global ().local () }
+  {
+    if (!r_->free_slots)
+      throw std::length_error ("out of hazard pointers");
+
+    slot_ = __builtin_ctz (r_->free_slots);
+    r_->free_slots &= ~(1u << slot_);
+  }
+
+  ~hazard_pointer ()
+  {
+    reset_protection ();
+    r_->free_slots |= 1u << slot_;
+  }
+
+  hazard_pointer (const hazard_pointer &) = delete;
+  hazard_pointer &operator= (const hazard_pointer &) = delete;
+
+  // Returns the value of src, which stays valid until the protection is
+  // reset or replaced even if another thread retires it meanwhile.
+  template <class T>
+  T *
+  protect (const std::atomic<T *> &src) noexcept
+  {
+    T *p = src.load (std::memory_order_relaxed);
+    for (;;)
+      {
+	hazard ().store (p, std::memory_order_relaxed);
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+	T *q = src.load (std::memory_order_acquire);
+	if (q == p)
+	  return p;
+	p = q;
+      }
+  }
+
+  // Protects p without validating it; the caller must check it is still
+  // reachable afterwards.
+  template <class T>
+  void
+  reset_protection (const T *p) noexcept
+  {
+    hazard ().store (p, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+  }
+
+  void
+  reset_protection () noexcept
+  {
+    hazard ().store (nullptr, std::memory_order_release);
+  }
+
+private:
+  std::atomic<const void *> &
+  hazard () const noexcept
+  {
+    return r_->hazards[slot_];
+  }
+
+  hazard_domain::record *r_;
+  unsigned slot_;
+};
+
+class epoch_guard;
+
+class epoch_domain
+{
+  friend class epoch_guard;
+
+public:
+  static constexpr size_t batch = 64;
+
+  static epoch_domain &
+  global ()
+  {
+    static epoch_domain d;
+    return d;
+  }
+
+  // p must already be unreachable for critical sections that start from
+  // now on.
+  void
+  retire (void *p, void (*reclaim) (void *))
+  {
+    record &r = local ();
+    uint64_t e = epoch_.load (std::memory_order_seq_cst);
+    r.retired.push_back (tagged{ retired_ptr{ p, reclaim }, e });
+    if (r.retired.size () >= r.next_scan)
+      scan (r);
+  }
+
+  template <class T>
+  void
+  retire (T *p)
+  {
+    retire (p, &delete_retired<T>);
+  }
+
+  ~epoch_domain ()
+  {
+    for (record *r = records_.head (); r; r = r->next)
+      for (const tagged &t : r->retired)
+	t.rp.reclaim (t.rp.p);
+  }
+
+private:
+  struct tagged
+  {
+    retired_ptr rp;
+    uint64_t epoch;
+  };
+
+  struct record
+  {
+    // Zero outside critical sections, else one more than the global epoch
+    // seen on entry.
+    std::atomic<uint64_t> active{ 0 };
+    unsigned depth = 0;
+    std::vector<tagged> retired;
+    size_t next_scan = batch;
+    std::atomic<bool> in_use{ false };
+    record *next = nullptr;
+  };
+
+  class owner
+  {
+  public:
+    explicit owner (epoch_domain &d) : d_{ d }, r_{ d.records_.acquire () }
+    {
+    }
+
+    ~owner ()
+    {
+      d_.scan (*r_);
+      d_.records_.release (r_);
+    }
+
+    record &
+    get () const noexcept
+    {
+      return *r_;
+    }
+
+  private:
+    epoch_domain &d_;
+    record *r_;
+  };
+
+  epoch_domain () : epoch_{ 0 } {}
+
+  record &
+  local ()
+  {
+    thread_local owner o{ *this };
+    return o.get ();
+  }
+
+  void
+  enter (record &r) noexcept
+  {
+    if (r.depth++ == 0)
+      {
+	r.active.store (epoch_.load (std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+      }
+  }
+
+  void
+  leave (record &r) noexcept
+  {
+    if (--r.depth == 0)
+      r.active.store (0, std::memory_order_release);
+  }
+
+  // The epoch moves on once every thread inside a critical section has
+  // seen the current one; a node retired in epoch e is then unreachable
+  // for everybody by the time the epoch reaches e + 2.
+  void
+  scan (record &r)
+  {
+    uint64_t e = epoch_.load (std::memory_order_seq_cst);
+    if (try_advance (e))
+      e++;
+
+    auto reclaimable = std::find_if (
+	r.retired.begin (), r.retired.end (),
+	[e] (const tagged &t) { return t.epoch + 2 > e; });
+
+    std::vector<tagged> done (r.retired.begin (), reclaimable);
+    r.retired.erase (r.retired.begin (), reclaimable);
+    r.next_scan = r.retired.size () + batch;
+
+    for (const tagged &t : done)
+      t.rp.reclaim (t.rp.p);
+  }
+
+  bool
+  try_advance (uint64_t e) noexcept
+  {
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    for (record *o = records_.head (); o; o = o->next)
+      {
+	uint64_t a = o->active.load (std::memory_order_relaxed);
+	if (a && a != e + 1)
+	  return false;
+      }
+    return epoch_.compare_exchange_strong (e, e + 1,
+					   std::memory_order_seq_cst);
+  }
+
+  std::atomic<uint64_t> epoch_;
+  record_registry<record> records_;
+};
+
+// Marks a critical section of the calling thread: nodes it reads from a
+// structure that retires into epoch_domain stay valid until it ends.
+// Sections nest.
+class epoch_guard
+{
+public:
+  epoch_guard () : r_{ &epoch_domain::global ().local () }
+  {
+    epoch_domain::global ().enter (*r_);
+  }
+
+  ~epoch_guard () { epoch_domain::global ().leave (*r_); }
+
+  epoch_guard (const epoch_guard &) = delete;
+  epoch_guard &operator= (const epoch_guard &) = delete;
+
+private:
+  epoch_domain::record *r_;
+};
+
+#endif // RECLAMATION_H
@@ -0,0 +1,115 @@
+#ifndef REF_COUNT_POLICY_H
+#define REF_COUNT_POLICY_H
+
+#include <atomic>
+
+// Reference count representations for shared_ptr, weak_ptr and
+// intrusive_ptr. decrement () returns true when the count reaches zero, and
+// then everything other owners did before their own decrement is visible to
+// the caller.
+
+// Safe to share between threads; the default.
+struct atomic_policy
+{
+  class counter
+  {
+  public:
+    explicit counter (long n) noexcept : n_{ n } {}
+
+    void
+    increment () noexcept
+    {
+      n_.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    bool
+    decrement () noexcept
+    {
+      if (n_.fetch_sub (1, std::memory_order_release) != 1)
+	return false;
+
+      std::atomic_thread_fence (std::memory_order_acquire);
+      return true;
+    }
+
+    bool
+    increment_if_nonzero () noexcept
+    {
+      for (long n = n_.load (std::memory_order_relaxed);;)
+	{
+	  if (n == 0)
+	    return false;
+
+	  if (n_.compare_exchange_weak (n, n + 1, std::memory_order_acquire,
+					std::memory_order_relaxed))
+	    return true;
+	}
+    }
+
+    // Adjusts the count by n in one step; must not bring it to zero.
+    void
+    add (long n) noexcept
+    {
+      n_.fetch_add (n, std::memory_order_relaxed);
+    }
+
+    long
+    load () const noexcept
+    {
+      return n_.load (std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<long> n_;
+  };
+};
+
+// Plain integers, for objects that never leave one thread or strand: every
+// copy and release becomes an ordinary increment instead of a locked
+// read-modify-write. Sharing such a pointer across threads is a data race.
+struct single_threaded_policy
+{
+  class counter
+  {
+  public:
+    explicit counter (long n) noexcept : n_{ n } {}
+
+    void
+    increment () noexcept
+    {
+      ++n_;
+    }
+
+    bool
+    decrement () noexcept
+    {
+      return --n_ == 0;
+    }
+
+    bool
+    increment_if_nonzero () noexcept
+    {
+      if (n_ == 0)
+	return false;
+      ++n_;
+      return true;
+    }
+
+    void
+    add (long n) noexcept
+    {
+      n_ += n;
+    }
+
+    long
+    load () const noexcept
+    {
+      return n_;
+    }
+
+  private:
+    long n_;
+  };
+};
+
+#endif // REF_COUNT_POLICY_H
@@ -3,9 +3,13 @@
 
 #include <atomic>
 #include <cstddef>
+#include <memory>
+#include <new>
 #include <type_traits>
 #include <utility>
 
+#include "ref_count_policy.h"
+
 template <bool If>
 using enable_if = typename std::enable_if<If, int>::type;
 
@@ -48,10 +52,11 @@ struct default_delete
   }
 };
 
+template <class Policy = atomic_policy>
 struct control_block_base
 {
-  std::atomic<long> use_count;
-  std::atomic<long> weak_count;
+  typename Policy::counter use_count;
+  typename Policy::counter weak_count;
 
   control_block_base () : use_count{ 1 }, weak_count{ 1 } {}
   virtual ~control_block_base () = default;
@@ -59,15 +64,14 @@ struct control_block_base
   void
   inc_use_count ()
   {
-    use_count.fetch_add (1, std::memory_order_relaxed);
+    use_count.increment ();
   }
 
   void
   dec_use_count ()
   {
-    if (use_count.fetch_sub (1, std::memory_order_release) == 1)
+    if (use_count.decrement ())
       {
-	std::atomic_thread_fence (std::memory_order_acquire);
 	dispose ();
 	dec_weak_count ();
       }
@@ -76,40 +80,29 @@ struct control_block_base
   bool
   lock_use_count ()
   {
-    for (long n = use_count.load (std::memory_order_relaxed);;)
-      {
-	if (n == 0)
-	  return false;
-
-	if (use_count.compare_exchange_weak (n, n + 1,
-					     std::memory_order_acquire,
-					     std::memory_order_relaxed))
-	  return true;
-      }
+    return use_count.increment_if_nonzero ();
   }
 
   void
   inc_weak_count ()
   {
-    weak_count.fetch_add (1, std::memory_order_relaxed);
+    weak_count.increment ();
   }
 
   void
   dec_weak_count ()
   {
-    if (weak_count.fetch_sub (1, std::memory_order_release) == 1)
-      {
-	std::atomic_thread_fence (std::memory_order_acquire);
-	destroy ();
-      }
+    if (weak_count.decrement ())
+      destroy ();
   }
 
   virtual void dispose () = 0;
   virtual void destroy () = 0;
 };
 
-template <class T, class Deleter, enable_if_callable<Deleter, T *> = 0>
-struct control_block : control_block_base
+template <class T, class Deleter, class Policy = atomic_policy,
+	  enable_if_callable<Deleter, T *> = 0>
+struct control_block : control_block_base<Policy>
 {
   T *p;
   Deleter d;
@@ -130,25 +123,116 @@ struct control_block : control_block_base
   }
 };
 
-template <class T>
+// Holds the object itself, so make_shared_ptr needs a single allocation. The
+// object is destroyed with the last shared_ptr, but its storage is only
+// released together with the block, once the last weak_ptr is gone.
+template <class T, class Policy = atomic_policy>
+struct inplace_control_block : control_block_base<Policy>
+{
+  alignas (T) unsigned char storage[sizeof (T)];
+
+  template <class... Args>
+  explicit inplace_control_block (Args &&...args)
+  {
+    ::new (static_cast<void *> (storage)) T (std::forward<Args> (args)...);
+  }
+
+  T *
+  get () noexcept
+  {
+    return reinterpret_cast<T *> (storage);
+  }
+
+  void
+  dispose () override
+  {
+    get ()->~T ();
+  }
+
+  void
+  destroy () override
+  {
+    delete this;
+  }
+};
+
+// inplace_control_block whose storage comes from, and goes back to, a
+// copy of the user's allocator rebound to the block type.
+template <class T, class Alloc, class Policy = atomic_policy>
+struct alloc_inplace_control_block : control_block_base<Policy>
+{
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<
+      alloc_inplace_control_block>
+      allocator_type;
+  typedef std::allocator_traits<allocator_type> traits;
+
+  allocator_type alloc;
+  alignas (T) unsigned char storage[sizeof (T)];
+
+  template <class... Args>
+  explicit alloc_inplace_control_block (const allocator_type &a,
+					Args &&...args)
+      : alloc{ a }
+  {
+    ::new (static_cast<void *> (storage)) T (std::forward<Args> (args)...);
+  }
+
+  T *
+  get () noexcept
+  {
+    return reinterpret_cast<T *> (storage);
+  }
+
+  void
+  dispose () override
+  {
+    get ()->~T ();
+  }
+
+  void
+  destroy () override
+  {
+    allocator_type a{ std::move (alloc) };
+    this->~alloc_inplace_control_block ();
+    traits::deallocate (a, this, 1);
+  }
+};
+
+template <class T, class Policy = atomic_policy>
 class weak_ptr;
 
-template <class T>
+template <class T, class Policy = atomic_policy>
 class shared_ptr;
 
-template <class T>
+template <class T, class Policy = atomic_policy>
+class enable_shared_from_this;
+
+// Policy chooses how the reference counts are kept (see
+// ref_count_policy.h); pointers with different policies do not mix.
+template <class T, class Policy>
 class shared_ptr
 {
-  template <class>
+  template <class, class>
   friend class weak_ptr;
 
-  template <class>
+  template <class, class>
   friend class shared_ptr;
 
+  template <class>
+  friend class atomic_shared_ptr;
+
+  template <class U, class P, class... Args>
+  friend shared_ptr<U, P> make_shared_ptr (Args &&...args);
+
+  template <class U, class P, class Alloc, class... Args>
+  friend shared_ptr<U, P> allocate_shared_ptr (const Alloc &alloc,
+					       Args &&...args);
+
 public:
   typedef T *pointer;
   typedef T element_type;
-  typedef weak_ptr<T> weak_type;
+  typedef weak_ptr<T, Policy> weak_type;
+  typedef Policy policy_type;
 
   shared_ptr () noexcept : px_{}, pb_{} {}
   shared_ptr (std::nullptr_t) noexcept : shared_ptr{} {}
@@ -161,13 +245,14 @@ public:
   {
     try
       {
-	pb_ = new control_block<U, Deleter>{ p, std::move (d) };
+	pb_ = new control_block<U, Deleter, Policy>{ p, std::move (d) };
       }
     catch (...)
       {
 	d (p);
 	throw;
       }
+    enable_weak_this (p);
   }
 
   ~shared_ptr ()
@@ -192,7 +277,7 @@ public:
   }
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
-  shared_ptr (const shared_ptr<U> &other) noexcept
+  shared_ptr (const shared_ptr<U, Policy> &other) noexcept
       : px_{ other.px_ }, pb_{ other.pb_ }
   {
     if (pb_)
@@ -201,7 +286,7 @@ public:
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
   shared_ptr &
-  operator= (const shared_ptr<U> &other) noexcept
+  operator= (const shared_ptr<U, Policy> &other) noexcept
   {
     shared_ptr t{ other };
     swap (*this, t);
@@ -223,7 +308,7 @@ public:
   }
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
-  shared_ptr (shared_ptr<U> &&other) noexcept
+  shared_ptr (shared_ptr<U, Policy> &&other) noexcept
       : px_{ other.px_ }, pb_{ other.pb_ }
   {
     other.px_ = nullptr;
@@ -232,7 +317,7 @@ public:
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
   shared_ptr &
-  operator= (shared_ptr<U> &&other) noexcept
+  operator= (shared_ptr<U, Policy> &&other) noexcept
   {
     shared_ptr t{ std::move (other) };
     swap (*this, t);
@@ -277,7 +362,7 @@ public:
   long
   use_count () const noexcept
   {
-    return pb_ ? pb_->use_count.load (std::memory_order_relaxed) : 0;
+    return pb_ ? pb_->use_count.load () : 0;
   }
 
   friend void
@@ -289,8 +374,77 @@ public:
   }
 
 private:
+  // Adopts a reference the caller already holds on pb.
+  shared_ptr (T *px, control_block_base<Policy> *pb) noexcept
+      : px_{ px }, pb_{ pb }
+  {
+  }
+
+  // Points the weak_ptr inside an enable_shared_from_this base at the new
+  // owner, unless another shared_ptr got there first.
+  template <class V>
+  void
+  enable_weak_this (const enable_shared_from_this<V, Policy> *e) noexcept
+  {
+    if (!e || !e->weak_this_.expired ())
+      return;
+
+    auto *self = const_cast<enable_shared_from_this<V, Policy> *> (e);
+    weak_ptr<V, Policy> w;
+    w.px_ = static_cast<V *> (self);
+    w.pb_ = pb_;
+    pb_->inc_weak_count ();
+    e->weak_this_ = std::move (w);
+  }
+
+  void
+  enable_weak_this (...) noexcept
+  {
+  }
+
   pointer px_;
-  control_block_base *pb_;
+  control_block_base<Policy> *pb_;
 };
 
+// Named apart from std::make_shared, which argument-dependent lookup finds
+// as soon as an argument is of a std type and which would otherwise be an
+// equally good match; likewise allocate_shared_ptr.
+template <class T, class Policy = atomic_policy, class... Args>
+shared_ptr<T, Policy>
+make_shared_ptr (Args &&...args)
+{
+  typedef inplace_control_block<T, Policy> block;
+
+  block *pb = new block{ std::forward<Args> (args)... };
+  auto *base = static_cast<control_block_base<Policy> *> (pb);
+  shared_ptr<T, Policy> sp{ pb->get (), base };
+  sp.enable_weak_this (sp.px_);
+  return sp;
+}
+
+template <class T, class Policy = atomic_policy, class Alloc, class... Args>
+shared_ptr<T, Policy>
+allocate_shared_ptr (const Alloc &alloc, Args &&...args)
+{
+  typedef alloc_inplace_control_block<T, Alloc, Policy> block;
+  typename block::allocator_type a (alloc);
+
+  block *pb = block::traits::allocate (a, 1);
+  try
+    {
+      ::new (static_cast<void *> (pb))
+	  block{ a, std::forward<Args> (args)... };
+    }
+  catch (...)
+    {
+      block::traits::deallocate (a, pb, 1);
+      throw;
+    }
+
+  auto *base = static_cast<control_block_base<Policy> *> (pb);
+  shared_ptr<T, Policy> sp{ pb->get (), base };
+  sp.enable_weak_this (sp.px_);
+  return sp;
+}
+
 #endif // SHARED_PTR_H
@@ -0,0 +1,122 @@
+// Build without CMake: g++ -std=c++17 -pthread -I.. shared_ptr_test.cc
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pool_allocator.h"
+#include "shared_ptr.h"
+#include "weak_ptr.h"
+
+// Unlike assert (), also checks in release builds.
+#define CHECK(cond)                                                           \
+  do                                                                          \
+    {                                                                         \
+      if (!(cond))                                                            \
+	{                                                                     \
+	  std::fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__,        \
+			__LINE__, #cond);                                     \
+	  std::abort ();                                                      \
+	}                                                                     \
+    }                                                                         \
+  while (0)
+
+struct session
+{
+  session (std::string peer, std::vector<int> ports)
+      : peer (std::move (peer)), ports (std::move (ports))
+  {
+    live++;
+  }
+
+  ~session () { live--; }
+
+  std::string peer;
+  std::vector<int> ports;
+
+  static int live;
+};
+
+int session::live = 0;
+
+// Arguments of std types make argument-dependent lookup find
+// std::make_shared and std::allocate_shared too; the calls below must
+// still pick ours.
+static void
+test_std_arguments ()
+{
+  std::string peer ("10.0.0.1");
+
+  shared_ptr<std::string> s = make_shared_ptr<std::string> (peer);
+  CHECK (*s == peer);
+  CHECK (s.use_count () == 1);
+
+  shared_ptr<session> p = allocate_shared_ptr<session> (
+      pool_allocator<session> (), std::string (peer),
+      std::vector<int>{ 80, 443 });
+  CHECK (p->peer == peer);
+  CHECK (p->ports.size () == 2);
+  CHECK (session::live == 1);
+
+  // std::allocator rebinds through allocator_traits as well.
+  shared_ptr<std::string> a
+      = allocate_shared_ptr<std::string> (std::allocator<char> (), peer);
+  CHECK (*a == peer);
+}
+
+// The object goes with the last shared_ptr, its block with the last
+// weak_ptr.
+static void
+test_lifetime ()
+{
+  weak_ptr<session> w;
+  {
+    auto p = allocate_shared_ptr<session> (pool_allocator<session> (),
+					   "peer", std::vector<int>{});
+    w = p;
+    CHECK (session::live == 1);
+    CHECK (!w.expired ());
+  }
+  CHECK (session::live == 0);
+  CHECK (w.expired ());
+  CHECK (!w.lock ());
+}
+
+// Blocks freed on another thread than the one that allocated them migrate
+// between the pool's caches.
+static void
+test_cross_thread ()
+{
+  constexpr int count = 10000;
+  std::vector<shared_ptr<session>> made;
+  made.reserve (count);
+
+  std::thread producer (
+      [&made] ()
+	{
+	  for (int i = 0; i < count; i++)
+	    made.push_back (allocate_shared_ptr<session> (
+		pool_allocator<session> (), std::to_string (i),
+		std::vector<int>{ i }));
+	});
+  producer.join ();
+
+  CHECK (session::live == count);
+  for (int i = 0; i < count; i++)
+    CHECK (made[i]->ports[0] == i);
+  made.clear ();
+  CHECK (session::live == 0);
+}
+
+int
+main ()
+{
+  test_std_arguments ();
+  CHECK (session::live == 0);
+  test_lifetime ();
+  test_cross_thread ();
+  std::puts ("ok");
+}
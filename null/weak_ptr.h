@@ -3,18 +3,19 @@
 
 #include "shared_ptr.h"
 
-template <class T>
+template <class T, class Policy>
 class weak_ptr
 {
-  template <class>
+  template <class, class>
   friend class weak_ptr;
 
-  template <class>
+  template <class, class>
   friend class shared_ptr;
 
 public:
   typedef T *pointer;
   typedef T element_type;
+  typedef Policy policy_type;
 
   constexpr weak_ptr () : px_{}, pb_{} {}
 
@@ -25,7 +26,8 @@ public:
   }
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
-  weak_ptr (const shared_ptr<U> &sp) noexcept : px_{ sp.px_ }, pb_{ sp.pb_ }
+  weak_ptr (const shared_ptr<U, Policy> &sp) noexcept
+      : px_{ sp.px_ }, pb_{ sp.pb_ }
   {
     if (pb_)
       pb_->inc_weak_count ();
@@ -33,7 +35,7 @@ public:
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
   weak_ptr &
-  operator= (const shared_ptr<U> &sp) noexcept
+  operator= (const shared_ptr<U, Policy> &sp) noexcept
   {
     weak_ptr t{ sp };
     swap (*this, t);
@@ -56,7 +58,7 @@ public:
   }
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
-  weak_ptr (const weak_ptr<U> &other) noexcept
+  weak_ptr (const weak_ptr<U, Policy> &other) noexcept
       : px_{ other.px_ }, pb_{ other.pb_ }
   {
     if (pb_)
@@ -65,7 +67,7 @@ public:
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
   weak_ptr &
-  operator= (const weak_ptr<U> &other) noexcept
+  operator= (const weak_ptr<U, Policy> &other) noexcept
   {
     weak_ptr t{ other };
     swap (*this, t);
@@ -87,7 +89,8 @@ public:
   }
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
-  weak_ptr (weak_ptr<U> &&other) noexcept : px_{ other.px_ }, pb_{ other.pb_ }
+  weak_ptr (weak_ptr<U, Policy> &&other) noexcept
+      : px_{ other.px_ }, pb_{ other.pb_ }
   {
     other.px_ = nullptr;
     other.pb_ = nullptr;
@@ -95,19 +98,19 @@ public:
 
   template <class U, enable_if<std::is_convertible<U *, T *>::value> = 0>
   weak_ptr &
-  operator= (weak_ptr<U> &&other) noexcept
+  operator= (weak_ptr<U, Policy> &&other) noexcept
   {
     weak_ptr t{ std::move (other) };
     swap (*this, t);
     return *this;
   }
 
-  shared_ptr<T>
+  shared_ptr<T, Policy>
   lock () noexcept
   {
     if (pb_ && pb_->lock_use_count ())
       {
-	shared_ptr<T> sp;
+	shared_ptr<T, Policy> sp;
 	sp.px_ = px_;
 	sp.pb_ = pb_;
 	return sp;
@@ -131,7 +134,7 @@ public:
   long
   use_count () const noexcept
   {
-    return pb_ ? pb_->use_count.load (std::memory_order_relaxed) : 0;
+    return pb_ ? pb_->use_count.load () : 0;
   }
 
   friend void
@@ -144,7 +147,7 @@ public:
 
 private:
   pointer px_;
-  control_block_base *pb_;
+  control_block_base<Policy> *pb_;
 };
 
 #endif // WEAK_PTR_H